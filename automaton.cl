@@ -1,28 +1,329 @@
+// keep products and sums separate, so all kernel variants round the same way
+#pragma OPENCL FP_CONTRACT OFF
+
 int mod(a, b) {
     return (((a % b) + b) % b);
 }
 
-__kernel void automaton(__constant float* state_in, __global float* state_out, __constant float* rules) {
+// linear index of a cell, 64 bit so that n * n * m may exceed the int range
+size_t cell_idx(int x, int y, int width) {
+    return (size_t)x + (size_t)width * (size_t)y;
+}
+
+// a band of a larger grid stores one halo row above and below its own rows, filled by the host after every generation,
+// so rows never wrap and its own rows start at index 1
+#ifdef BANDED
+#define HALO_ROWS 1
+#define WRAP_ROW(y, height) ((y) + HALO_ROWS)
+#else
+#define HALO_ROWS 0
+#define WRAP_ROW(y, height) mod((y), (height))
+#endif
+
+// dimension 2 counts the levels of all INSTANCES, every instance reads its own state and rules
+__kernel void automaton(__global const state_t* state_in, __global state_t* state_out, __constant float* rules) {
     int x = get_global_id(0);
     int y = get_global_id(1);
-    int level = get_global_id(2);
     int width = get_global_size(0);
     int height = get_global_size(1);
-    int m = get_global_size(2);
+    int m = get_global_size(2) / INSTANCES;
+    int instance = get_global_id(2) / m;
+    int level = get_global_id(2) % m;
+    state_in += INSTANCE_STATE(instance, m);
+    state_out += INSTANCE_STATE(instance, m);
+    rules += instance * (9 * m * m + m);
 
     float sum = rules[level + 9 * m * m];
     for (int dx = -1; dx <= 1; ++dx) {
         int state_x = mod(x + dx, width);
         int rules_x = dx + 1;
         for (int dy = -1; dy <= 1; ++dy) {
-            int state_y = mod(y + dy, height);
+            int state_y = WRAP_ROW(y + dy, height);
+            int rules_y = dy + 1;
+            for (int dlevel = 0; dlevel < m; ++dlevel) {
+                size_t state_idx = STATE_IDX(cell_idx(state_x, state_y, width), dlevel, m);
+                int rules_idx = dlevel + level * m + (rules_x + 3 * rules_y) * m * m;
+                sum += STATE_LOAD(state_in, state_idx) * rules[rules_idx];
+            }
+        }
+    }
+    STATE_STORE(state_out, STATE_IDX(cell_idx(x, y + HALO_ROWS, width), level, m), max(0.f, min(sum, 1.f)));
+}
+
+#if defined(STATE_PLANE) && defined(STATE_VEC)
+// `automaton` for STATE_VEC neighbouring cells of one level per work-item, so that the loads along x become vector loads
+// of the planar layout. Sums in the same order as `automaton`. Requires NDRange(n / STATE_VEC, n, m).
+__kernel void automaton_planar(__global const state_t* state_in, __global state_t* state_out, __constant float* rules) {
+    int x = get_global_id(0) * STATE_VEC;
+    int y = get_global_id(1);
+    int level = get_global_id(2);
+    int width = get_global_size(0) * STATE_VEC;
+    int height = get_global_size(1);
+    int m = get_global_size(2);
+
+    floatv sum = (floatv)(rules[level + 9 * m * m]);
+    for (int dx = -1; dx <= 1; ++dx) {
+        int rules_x = dx + 1;
+        for (int dy = -1; dy <= 1; ++dy) {
+            int state_y = WRAP_ROW(y + dy, height);
             int rules_y = dy + 1;
             for (int dlevel = 0; dlevel < m; ++dlevel) {
-                int state_idx = dlevel + (state_x + width * state_y) * m;
+                size_t row = STATE_IDX(cell_idx(0, state_y, width), dlevel, m);
                 int rules_idx = dlevel + level * m + (rules_x + 3 * rules_y) * m * m;
-                sum += state_in[state_idx] * rules[rules_idx];
+                sum += state_vload_row(state_in, row, x, dx, width) * rules[rules_idx];
+            }
+        }
+    }
+    STATE_VSTORE(state_out, STATE_IDX(cell_idx(x, y + HALO_ROWS, width), level, m), max(min(sum, 1.f), 0.f));
+}
+#endif
+
+#if defined(TILED_M) && defined(TILED_TILE)
+#define TILED_SPAN (TILED_TILE + 2)
+
+// loads the tile whose upper left cell is (x0 + 1, y0 + 1) plus a one-cell toroidal halo to local memory, must be called
+// by all work-items of the group
+void tile_load(__local float* tile, __global const state_t* state_in, int x0, int y0, int width, int height) {
+    // linear copy, uses memory coalescing along the rows
+    for (int i = get_local_id(0) + get_local_id(1) * TILED_TILE; i < TILED_SPAN * TILED_SPAN * TILED_M; i += TILED_TILE * TILED_TILE) {
+        int cell = i / TILED_M;
+        int state_x = mod(x0 + cell % TILED_SPAN, width);
+        int state_y = WRAP_ROW(y0 + cell / TILED_SPAN, height);
+        tile[i] = STATE_LOAD(state_in, STATE_IDX(cell_idx(state_x, state_y, width), i % TILED_M, TILED_M));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// new value of one level of the cell at (tile_x, tile_y) of a loaded tile
+float tile_step(__local const float* tile, __constant float* rules, int tile_x, int tile_y, int level) {
+    float sum = rules[level + 9 * TILED_M * TILED_M];
+    for (int dx = -1; dx <= 1; ++dx) {
+        int rules_x = dx + 1;
+        for (int dy = -1; dy <= 1; ++dy) {
+            int rules_y = dy + 1;
+            for (int dlevel = 0; dlevel < TILED_M; ++dlevel) {
+                int tile_idx = dlevel + ((tile_x + dx) + TILED_SPAN * (tile_y + dy)) * TILED_M;
+                int rules_idx = dlevel + level * TILED_M + (rules_x + 3 * rules_y) * TILED_M * TILED_M;
+                sum += tile[tile_idx] * rules[rules_idx];
+            }
+        }
+    }
+    return max(0.f, min(sum, 1.f));
+}
+
+// same computation as `automaton`, but every work-group loads its tile plus a one-cell toroidal halo to local memory
+// once and every work-item computes all levels of its cell. Requires NDRange(n, n) and NDRange(TILED_TILE, TILED_TILE).
+__kernel __attribute__((reqd_work_group_size(TILED_TILE, TILED_TILE, 1)))
+void automaton_tiled(__global const state_t* state_in, __global state_t* state_out, __constant float* rules) {
+    __local float tile[TILED_SPAN * TILED_SPAN * TILED_M];
+
+    int width = get_global_size(0);
+    int height = get_global_size(1);
+    tile_load(tile, state_in, get_group_id(0) * TILED_TILE - 1, get_group_id(1) * TILED_TILE - 1, width, height);
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    for (int level = 0; level < TILED_M; ++level) {
+        float value = tile_step(tile, rules, get_local_id(0) + 1, get_local_id(1) + 1, level);
+        STATE_STORE(state_out, STATE_IDX(cell_idx(x, y + HALO_ROWS, width), level, TILED_M), value);
+    }
+}
+
+// `automaton_tiled` for the tiles `tiles[0 .. *count)` only, as collected by `activate_tiles`. There is one work-group
+// per tile of the grid, the surplus ones return at once, so the work follows the number of active tiles without a
+// round trip to the host. Sets `changed[tile]` if any stored value of the tile changed. Requires NDRange(n, n) and
+// NDRange(TILED_TILE, TILED_TILE).
+__kernel __attribute__((reqd_work_group_size(TILED_TILE, TILED_TILE, 1)))
+void automaton_sparse(__global const state_t* state_in, __global state_t* state_out, __constant float* rules, __global const uint* tiles, __global const uint* count, __global uint* changed) {
+    __local float tile[TILED_SPAN * TILED_SPAN * TILED_M];
+
+    // the same for the whole group, so no work-item misses a barrier
+    uint group = get_group_id(0) + get_group_id(1) * get_num_groups(0);
+    if (group >= *count) {
+        return;
+    }
+    uint tile_id = tiles[group];
+    int tile_x0 = (tile_id % get_num_groups(0)) * TILED_TILE;
+    int tile_y0 = (tile_id / get_num_groups(0)) * TILED_TILE;
+
+    int width = get_global_size(0);
+    int height = get_global_size(1);
+    tile_load(tile, state_in, tile_x0 - 1, tile_y0 - 1, width, height);
+
+    int x = tile_x0 + get_local_id(0);
+    int y = tile_y0 + get_local_id(1);
+    int tile_idx = (get_local_id(0) + 1 + TILED_SPAN * (get_local_id(1) + 1)) * TILED_M;
+    bool diff = false;
+    for (int level = 0; level < TILED_M; ++level) {
+        size_t state_idx = STATE_IDX(cell_idx(x, y + HALO_ROWS, width), level, TILED_M);
+        STATE_STORE(state_out, state_idx, tile_step(tile, rules, get_local_id(0) + 1, get_local_id(1) + 1, level));
+        // compare what was actually stored, so rounding of compact formats cannot keep a tile alive
+        diff |= STATE_LOAD(state_out, state_idx) != tile[tile_idx + level];
+    }
+    if (diff) {
+        changed[tile_id] = 1;
+    }
+}
+
+// `automaton_tiled`, `visualize` and `amplitudes` in one pass: while the new values of its cell are still in registers,
+// every work-item also writes its pixel to `texture`, and every work-group sums each level over its tile to
+// `partial[group * TILED_M + level]`, so the new state is never read back. Requires NDRange(n, rows) and
+// NDRange(TILED_TILE, TILED_TILE), TILED_TILE must be a power of 2.
+__kernel __attribute__((reqd_work_group_size(TILED_TILE, TILED_TILE, 1)))
+void automaton_fused(__global const state_t* state_in, __global state_t* state_out, __constant float* rules, __global float* partial, __global uchar4* texture, __constant float4* colors) {
+    __local float tile[TILED_SPAN * TILED_SPAN * TILED_M];
+    __local float lanes[TILED_TILE * TILED_TILE];
+
+    int width = get_global_size(0);
+    int height = get_global_size(1);
+    tile_load(tile, state_in, get_group_id(0) * TILED_TILE - 1, get_group_id(1) * TILED_TILE - 1, width, height);
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    float values[TILED_M];
+    float4 color = (float4)(0.f, 0.f, 0.f, 0.f);
+    for (int level = 0; level < TILED_M; ++level) {
+        size_t state_idx = STATE_IDX(cell_idx(x, y + HALO_ROWS, width), level, TILED_M);
+        float value = tile_step(tile, rules, get_local_id(0) + 1, get_local_id(1) + 1, level);
+        STATE_STORE(state_out, state_idx, value);
+#if STATE_FORMAT != 0
+        // the other stages see the rounded value, like the unfused kernels that read it back
+        value = STATE_LOAD(state_out, state_idx);
+#endif
+        values[level] = value;
+        color += value * colors[level];
+    }
+    color = max(0.f, min(color / (float)TILED_M, 1.f));
+    color.w = 1.f;
+    texture[cell_idx(x, y, width)] = convert_uchar4(color * 255.f);
+
+    // tree reduction of the tile, one level at a time
+    int lid = get_local_id(0) + get_local_id(1) * TILED_TILE;
+    int group = get_group_id(0) + get_group_id(1) * get_num_groups(0);
+    for (int level = 0; level < TILED_M; ++level) {
+        lanes[lid] = values[level];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int stride = TILED_TILE * TILED_TILE / 2; stride > 0; stride /= 2) {
+            if (lid < stride) {
+                lanes[lid] += lanes[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (lid == 0) {
+            partial[group * TILED_M + level] = lanes[0];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+#endif
+
+// collects the active tiles for `automaton_sparse`. Since the automaton is deterministic, a tile can only change if a
+// value in its neighbourhood changed in the last generation, so `changed` is dilated by one tile (wrapping around) and
+// compacted to `tiles`, `count` must be zero before. Clears `changed_next` for the coming launch. Requires
+// NDRange(n / TILED_TILE, n / TILED_TILE).
+__kernel void activate_tiles(__global const uint* changed, __global uint* changed_next, __global uint* tiles, __global uint* count) {
+    int tx = get_global_id(0);
+    int ty = get_global_id(1);
+    int tiles_x = get_global_size(0);
+    int tiles_y = get_global_size(1);
+
+    uint active = 0;
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            active |= changed[mod(tx + dx, tiles_x) + tiles_x * mod(ty + dy, tiles_y)];
+        }
+    }
+
+    uint tile = tx + tiles_x * ty;
+    changed_next[tile] = 0;
+    if (active) {
+        tiles[atomic_inc(count)] = tile;
+    }
+}
+
+#if defined(TILED_M) && defined(TILED_TILE) && defined(TEMPORAL_STEPS)
+#define TEMPORAL_SPAN (TILED_TILE + 2 * TEMPORAL_STEPS)
+
+// advances TEMPORAL_STEPS generations at once: every work-group loads its tile plus a TEMPORAL_STEPS-cell toroidal halo,
+// steps it in local memory (the valid region shrinks by one cell per step) and writes back only the interior. Since the
+// intermediate states never reach global memory, the per-level sums of every generation are written to
+// `partial[(step * ngroups + group) * TILED_M + level]` for the audio stage. Requires NDRange(n, n) and
+// NDRange(TILED_TILE, TILED_TILE), TILED_TILE must be a power of 2.
+__kernel __attribute__((reqd_work_group_size(TILED_TILE, TILED_TILE, 1)))
+void automaton_temporal(__global const state_t* state_in, __global state_t* state_out, __constant float* rules, __global float* partial) {
+    __local float tile0[TEMPORAL_SPAN * TEMPORAL_SPAN * TILED_M];
+    __local float tile1[TEMPORAL_SPAN * TEMPORAL_SPAN * TILED_M];
+    __local float lanes[TILED_TILE * TILED_TILE];
+
+    int width = get_global_size(0);
+    int height = get_global_size(1);
+    int x0 = get_group_id(0) * TILED_TILE - TEMPORAL_STEPS;
+    int y0 = get_group_id(1) * TILED_TILE - TEMPORAL_STEPS;
+    int lid = get_local_id(0) + get_local_id(1) * TILED_TILE;
+    int group = get_group_id(0) + get_group_id(1) * get_num_groups(0);
+    int ngroups = get_num_groups(0) * get_num_groups(1);
+
+    // linear copy, uses memory coalescing along the rows
+    for (int i = lid; i < TEMPORAL_SPAN * TEMPORAL_SPAN * TILED_M; i += TILED_TILE * TILED_TILE) {
+        int cell = i / TILED_M;
+        int state_x = mod(x0 + cell % TEMPORAL_SPAN, width);
+        int state_y = mod(y0 + cell / TEMPORAL_SPAN, height);
+        tile0[i] = STATE_LOAD(state_in, STATE_IDX(cell_idx(state_x, state_y, width), i % TILED_M, TILED_M));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    __local float* src = tile0;
+    __local float* dst = tile1;
+    int interior_idx = ((get_local_id(0) + TEMPORAL_STEPS) + TEMPORAL_SPAN * (get_local_id(1) + TEMPORAL_STEPS)) * TILED_M;
+    for (int step = 1; step <= TEMPORAL_STEPS; ++step) {
+        // only cells at least `step` cells away from the border still have a complete neighbourhood
+        int region = TEMPORAL_SPAN - 2 * step;
+        for (int i = lid; i < region * region * TILED_M; i += TILED_TILE * TILED_TILE) {
+            int level = i % TILED_M;
+            int cell = i / TILED_M;
+            int tile_x = step + cell % region;
+            int tile_y = step + cell / region;
+            float sum = rules[level + 9 * TILED_M * TILED_M];
+            for (int dx = -1; dx <= 1; ++dx) {
+                int rules_x = dx + 1;
+                for (int dy = -1; dy <= 1; ++dy) {
+                    int rules_y = dy + 1;
+                    for (int dlevel = 0; dlevel < TILED_M; ++dlevel) {
+                        int tile_idx = dlevel + ((tile_x + dx) + TEMPORAL_SPAN * (tile_y + dy)) * TILED_M;
+                        int rules_idx = dlevel + level * TILED_M + (rules_x + 3 * rules_y) * TILED_M * TILED_M;
+                        sum += src[tile_idx] * rules[rules_idx];
+                    }
+                }
+            }
+            dst[level + (tile_x + TEMPORAL_SPAN * tile_y) * TILED_M] = max(0.f, min(sum, 1.f));
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // tree reduction of the interior, one level at a time
+        for (int level = 0; level < TILED_M; ++level) {
+            lanes[lid] = dst[interior_idx + level];
+            barrier(CLK_LOCAL_MEM_FENCE);
+            for (int stride = TILED_TILE * TILED_TILE / 2; stride > 0; stride /= 2) {
+                if (lid < stride) {
+                    lanes[lid] += lanes[lid + stride];
+                }
+                barrier(CLK_LOCAL_MEM_FENCE);
             }
+            if (lid == 0) {
+                partial[((step - 1) * ngroups + group) * TILED_M + level] = lanes[0];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
         }
+
+        __local float* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    for (int level = 0; level < TILED_M; ++level) {
+        STATE_STORE(state_out, STATE_IDX(cell_idx(x, y, width), level, TILED_M), src[interior_idx + level]);
     }
-    state_out[level + (x + width * y) * m] = max(0.f, min(sum, 1.f));
 }
+#endif
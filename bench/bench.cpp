@@ -0,0 +1,360 @@
+#include <cmath>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+#include "pipeline.hpp"
+#include "scene.hpp"
+#include "state.hpp"
+#include "tool.hpp"
+#include "tuning.hpp"
+
+
+// Headless benchmark: runs the pipeline for every combination of the swept parameters without GUI and with a null
+// audio sink, then prints device time percentiles per stage and the throughput as JSON. Options that are not handled
+// here are passed on to parse_config, so every pipeline setting can be benchmarked:
+//
+//     s2015bench --sweep-n=64,256,1024 --sweep-nsamples=512,1024 --frames=2000 --queue-mode=in-order
+//
+// With a compact --state-format or --backend=cpu, every run also reports the error of state and audio against the fp32
+// OpenCL pipeline after --error-frames frames, the CPU backend runs without any OpenCL platform if there is none to
+// compare with. With --bands, the devices from --device on are used, e.g. --bands=2 --device-fission=numa splits a two socket CPU.
+// To compare the state layouts on a CPU device, run the same sweep with --state-layout=interleaved and planar, the
+// reported state_vector is 0 for the interleaved layout.
+//
+// With --tune=1, every combination of the swept parameters is autotuned instead: the launch shapes of all stages are
+// benchmarked for --frames frames each on the selected devices, and the fastest ones are stored as a profile in
+// --tuning-file, which s2015ocl and s2015offline load at startup.
+
+
+namespace {
+
+struct bench_config_t {
+    std::vector<std::size_t> sweep_n;
+    std::vector<std::size_t> sweep_m;
+    std::vector<std::size_t> sweep_reduction_size;
+    std::vector<std::size_t> sweep_nsamples;
+    std::size_t frames = 1000;
+    std::size_t warmup = 50;
+    std::size_t error_frames = 100;
+    std::size_t platform = 0;
+    std::size_t device = 0;
+    std::size_t tune = 0;
+    std::string output = "-";
+};
+
+std::vector<std::size_t> parse_list(const std::string& key, const std::string& value) {
+    std::vector<std::size_t> result;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        result.push_back(parse_size(key, item));
+    }
+    myassert(!result.empty(), "empty list for " + key);
+    return result;
+}
+
+// splits the arguments into bench options and the ones for parse_config
+bench_config_t parse_bench_config(int argc, char** argv, std::vector<char*>& rest) {
+    bench_config_t bench;
+    tool_options_t options = {
+        {"sweep-n", [&](const std::string& v) { bench.sweep_n = parse_list("sweep-n", v); }},
+        {"sweep-m", [&](const std::string& v) { bench.sweep_m = parse_list("sweep-m", v); }},
+        {"sweep-reduction-size", [&](const std::string& v) { bench.sweep_reduction_size = parse_list("sweep-reduction-size", v); }},
+        {"sweep-nsamples", [&](const std::string& v) { bench.sweep_nsamples = parse_list("sweep-nsamples", v); }},
+        {"frames", [&](const std::string& v) { bench.frames = parse_list("frames", v).front(); }},
+        {"warmup", [&](const std::string& v) { bench.warmup = parse_list("warmup", v).front(); }},
+        {"error-frames", [&](const std::string& v) { bench.error_frames = parse_list("error-frames", v).front(); }},
+        {"platform", [&](const std::string& v) { bench.platform = parse_list("platform", v).front(); }},
+        {"device", [&](const std::string& v) { bench.device = parse_list("device", v).front(); }},
+        {"tune", [&](const std::string& v) { bench.tune = parse_list("tune", v).front(); }},
+        {"output", [&](const std::string& v) { bench.output = v; }}
+    };
+
+    split_tool_options("bench", options, argc, argv, rest);
+    myassert(bench.frames > 0, "frames must be positive");
+    return bench;
+}
+
+// consumes everything the pipeline publishes, as fast as possible
+class NullSink {
+    public:
+        explicit NullSink(const shared_buffer_t<float>& audiobuffer) : audiobuffer(audiobuffer) {}
+
+        void drain() {
+            while (audiobuffer->read_block()) {
+                audiobuffer->commit_read();
+                samples += audiobuffer->block_size();
+            }
+        }
+
+        std::size_t consumed() const {
+            return samples;
+        }
+
+    private:
+        shared_buffer_t<float> audiobuffer;
+        std::size_t samples = 0;
+};
+
+// nearest-rank percentile, `values` gets sorted
+float percentile(std::vector<float>& values, float p) {
+    std::sort(values.begin(), values.end());
+    std::size_t rank = static_cast<std::size_t>(std::ceil(p * static_cast<float>(values.size())));
+    return values[std::max<std::size_t>(rank, 1) - 1];
+}
+
+void write_percentiles(std::ostream& out, const std::string& name, std::vector<float> values) {
+    out << "\"" << name << "\": {\"p50\": " << percentile(values, 0.5f) << ", \"p95\": " << percentile(values, 0.95f) << ", \"p99\": " << percentile(values, 0.99f) << "}";
+}
+
+std::string escape(const std::string& s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        if (c != '\0') {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// steps the fp32 OpenCL pipeline and the configured backend side by side and compares their audio and final state
+void write_state_error(const config_t& config, const bench_config_t& bench, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, std::ostream& out) {
+    log->info() << "compare against fp32 OpenCL for " << bench.error_frames << " frames";
+
+    config_t reference_config = config;
+    reference_config.backend = backend_t::opencl;
+    reference_config.state_format = state_format_t::fp32;
+    scene_t scene = make_demo_scene(config.n, config.m);
+    std::vector<shared_buffer_t<float>> audiobuffers;
+    std::vector<std::unique_ptr<Backend>> pipelines;
+    for (const config_t& c : {reference_config, config}) {
+        audiobuffers.push_back(std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(c), c.nsamples));
+        pipelines.push_back(makeBackend(c, context, devices, log, scene.state.data(), scene.rules, scene.frequencies, scene.colors, std::make_shared<TripleBuffer<texture_view_t>>(), audiobuffers.back()));
+    }
+
+    double audio_error = 0.;
+    double audio_energy = 0.;
+    std::size_t nsamples = 0;
+    for (std::size_t frame = 0; frame < bench.error_frames; ++frame) {
+        for (auto& pipeline : pipelines) {
+            pipeline->step();
+        }
+        for (std::size_t block = 0; block < config.generations_per_launch; ++block) {
+            const float* reference = audiobuffers[0]->read_block();
+            const float* compact = audiobuffers[1]->read_block();
+            for (std::size_t i = 0; i < config.nsamples; ++i) {
+                double diff = static_cast<double>(compact[i]) - static_cast<double>(reference[i]);
+                audio_error += diff * diff;
+                audio_energy += static_cast<double>(reference[i]) * static_cast<double>(reference[i]);
+            }
+            nsamples += config.nsamples;
+            audiobuffers[0]->commit_read();
+            audiobuffers[1]->commit_read();
+        }
+    }
+
+    std::vector<float> reference = pipelines[0]->read_state();
+    std::vector<float> compact = pipelines[1]->read_state();
+    double state_max = 0.;
+    double state_error = 0.;
+    for (std::size_t i = 0; i < reference.size(); ++i) {
+        double diff = std::abs(static_cast<double>(compact[i]) - static_cast<double>(reference[i]));
+        state_max = std::max(state_max, diff);
+        state_error += diff * diff;
+    }
+
+    double norm = nsamples > 0 ? 1. / static_cast<double>(nsamples) : 0.;
+    out << ", \"state_error\": {\"generations\": " << bench.error_frames * config.generations_per_launch;
+    out << ", \"max\": " << state_max << ", \"rms\": " << std::sqrt(state_error / static_cast<double>(reference.size()));
+    out << ", \"audio_rms\": " << std::sqrt(audio_error * norm) << ", \"audio_reference_rms\": " << std::sqrt(audio_energy * norm) << "}";
+}
+
+// finds the fastest launch shapes and stores them for the devices
+void tune(const config_t& config, const bench_config_t& bench, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, std::ostream& out) {
+    log->info() << "tune n=" << config.n << " m=" << config.m << " nsamples=" << config.nsamples;
+    std::string key = tuningKey(config, devices);
+    std::vector<std::string> options = tuneLaunchConfig(config, context, devices, log, bench.warmup, bench.frames);
+    if (!config.tuning_file.empty()) {
+        storeTuningProfile(config.tuning_file, key, options);
+        log->info() << "stored profile in " << config.tuning_file;
+    }
+
+    out << "{\"key\": \"" << escape(key) << "\", \"options\": [";
+    for (std::size_t i = 0; i < options.size(); ++i) {
+        out << (i > 0 ? ", \"" : "\"") << escape(options[i]) << "\"";
+    }
+    out << "]}";
+}
+
+void run(const config_t& config, const bench_config_t& bench, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, std::ostream& out) {
+    log->info() << "run " << (config.backend == backend_t::cpu ? "cpu" : "opencl") << " n=" << config.n << " m=" << config.m << " bands=" << config.bands << " reduction_size=" << config.reduction_size << " nsamples=" << config.nsamples;
+
+    scene_t scene = make_demo_scene(config.n, config.m);
+    auto hTexture = std::make_shared<TripleBuffer<texture_view_t>>();
+    auto audiobuffer = std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(config), config.nsamples);
+    NullSink sink(audiobuffer);
+    std::unique_ptr<Backend> pipeline = makeBackend(config, context, devices, log, scene.state.data(), scene.rules, scene.frequencies, scene.colors, hTexture, audiobuffer);
+
+    std::vector<frame_stats_t> stats;
+    stats.reserve(bench.frames);
+    std::size_t retired = 0;
+    pipeline->set_stats_callback([&](const frame_stats_t& s) {
+        if (retired >= bench.warmup && stats.size() < bench.frames) {
+            stats.push_back(s);
+        }
+        ++retired;
+    });
+
+    while (retired < bench.warmup) {
+        pipeline->poll();
+        sink.drain();
+    }
+    std::size_t consumed_start = sink.consumed();
+    auto start = std::chrono::steady_clock::now();
+    while (stats.size() < bench.frames) {
+        pipeline->poll();
+        sink.drain();
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::size_t consumed = sink.consumed() - consumed_start;
+    pipeline->drain();
+
+    double wall = std::chrono::duration<double>(end - start).count();
+    std::size_t generations = bench.frames * config.generations_per_launch;
+
+    std::vector<float> automaton, visualize, halo, render, reduce, download, host, active_tiles;
+    for (const auto& s : stats) {
+        active_tiles.push_back(static_cast<float>(s.active_tiles));
+        automaton.push_back(s.automaton);
+        visualize.push_back(s.visualize);
+        halo.push_back(s.halo);
+        render.push_back(s.render);
+        reduce.push_back(s.reduce);
+        download.push_back(s.download);
+        host.push_back(s.host);
+    }
+
+    out << "{\"backend\": \"" << (config.backend == backend_t::cpu ? "cpu" : "opencl") << "\", \"n\": " << config.n << ", \"m\": " << config.m << ", \"reduction_size\": " << config.reduction_size << ", \"nsamples\": " << config.nsamples;
+    out << ", \"state_bytes\": " << stateValueSize(config.state_format) << ", \"state_vector\": " << (config.state_layout == state_layout_t::planar ? config.state_vector : 0) << ", \"bands\": " << config.bands << ", \"generations_per_launch\": " << config.generations_per_launch << ", \"frames_in_flight\": " << config.frames_in_flight;
+    out << ", \"frames\": " << bench.frames << ", \"wall_s\": " << wall;
+    out << ", \"generations_per_s\": " << static_cast<double>(generations) / wall << ", \"samples_per_s\": " << static_cast<double>(consumed) / wall;
+    out << ", \"device_ms\": {";
+    write_percentiles(out, "automaton", automaton);
+    out << ", ";
+    write_percentiles(out, "visualize", visualize);
+    out << ", ";
+    write_percentiles(out, "halo", halo);
+    out << ", ";
+    write_percentiles(out, "render", render);
+    out << ", ";
+    write_percentiles(out, "reduce", reduce);
+    out << ", ";
+    write_percentiles(out, "download", download);
+    out << "}, \"host_ms\": {";
+    write_percentiles(out, "frame", host);
+    out << "}";
+    if (config.automaton_kernel == automaton_kernel_t::sparse) {
+        out << ", ";
+        write_percentiles(out, "active_tiles", active_tiles);
+    }
+    bool compare = config.backend == backend_t::cpu || config.state_format != state_format_t::fp32;
+    if (compare && bench.error_frames > 0 && !devices.empty()) {
+        write_state_error(config, bench, context, devices, log, out);
+    }
+    out << "}";
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    // stdout is reserved for the results
+    auto log = spdlog::stderr_logger_mt("bench");
+
+    try {
+        std::vector<char*> rest;
+        bench_config_t bench = parse_bench_config(argc, argv, rest);
+        config_t base = parse_config(static_cast<int>(rest.size()), rest.data());
+        if (bench.sweep_n.empty()) {
+            bench.sweep_n = {base.n};
+        }
+        if (bench.sweep_m.empty()) {
+            bench.sweep_m = {base.m};
+        }
+        if (bench.sweep_reduction_size.empty()) {
+            bench.sweep_reduction_size = {base.reduction_size};
+        }
+        if (bench.sweep_nsamples.empty()) {
+            bench.sweep_nsamples = {base.nsamples};
+        }
+
+        log->debug() << "get platform and device";
+        // no platform at all is only an error for the OpenCL backend
+        std::vector<cl::Platform> platforms = tool_platforms();
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        if (base.backend == backend_t::opencl || !platforms.empty()) {
+            devices = Pipeline::select_devices(base, tool_devices(platforms, bench.platform, bench.device));
+            context = cl::Context(devices);
+        } else {
+            log->warn() << "no OpenCL platform, run without reference";
+        }
+
+        std::ofstream file;
+        if (bench.output != "-") {
+            file.open(bench.output);
+            myassert(file.good(), "cannot open " + bench.output);
+        }
+        std::ostream& out = bench.output != "-" ? file : std::cout;
+
+        bool opencl = !devices.empty();
+        out << "{\"platform\": \"" << (opencl ? escape(platforms[bench.platform].getInfo<CL_PLATFORM_NAME>()) : "") << "\"";
+        out << ", \"device\": \"" << (opencl ? escape(devices[0].getInfo<CL_DEVICE_NAME>()) : "") << "\"";
+        out << ", \"driver\": \"" << (opencl ? escape(devices[0].getInfo<CL_DRIVER_VERSION>()) : "") << "\"";
+        out << ", \"runs\": [";
+        bool first = true;
+        for (std::size_t n : bench.sweep_n) {
+            for (std::size_t m : bench.sweep_m) {
+                for (std::size_t reduction_size : bench.sweep_reduction_size) {
+                    for (std::size_t nsamples : bench.sweep_nsamples) {
+                        config_t config = base;
+                        config.n = n;
+                        config.m = m;
+                        config.reduction_size = reduction_size;
+                        config.nsamples = nsamples;
+                        out << (first ? "\n  " : ",\n  ");
+                        if (bench.tune) {
+                            tune(config, bench, context, devices, log, out);
+                        } else {
+                            run(config, bench, context, devices, log, out);
+                        }
+                        out.flush();
+                        first = false;
+                    }
+                }
+            }
+        }
+        out << "\n]}" << std::endl;
+    } catch (const cl::Error& e) {
+        log->error() << e.what() << " (" << e.err() << ")";
+        return EXIT_FAILURE;
+    } catch (const std::exception& e) {
+        log->error() << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+# generates a C++ source that contains all OpenCL files of SOURCE_DIR as string literals
+# usage: cmake -DSOURCE_DIR=<dir> -DOUTPUT=<file> -P embed.cmake
+file (GLOB sources "${SOURCE_DIR}/*.cl")
+list (SORT sources)
+
+set (content "// generated by cmake/embed.cmake, do not edit\n#include \"kernels.hpp\"\n\nconst std::map<std::string, std::string>& embeddedKernelSources() {\n    static const std::map<std::string, std::string> sources = {\n")
+foreach (source ${sources})
+    get_filename_component (name "${source}" NAME)
+    file (READ "${source}" code)
+    set (content "${content}        {\"${name}\", R\"s2015ocl(${code})s2015ocl\"},\n")
+endforeach ()
+set (content "${content}    };\n    return sources;\n}\n")
+
+# only touch the output if something changed, avoids needless rebuilds
+if (EXISTS "${OUTPUT}")
+    file (READ "${OUTPUT}" old_content)
+endif ()
+if (NOT "${content}" STREQUAL "${old_content}")
+    file (WRITE "${OUTPUT}" "${content}")
+endif ()
@@ -0,0 +1,242 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include "common.hpp"
+#include "config.hpp"
+#include "ensemble.hpp"
+#include "opencl.hpp"
+#include "rulegen.hpp"
+#include "scene.hpp"
+#include "snapshot.hpp"
+#include "tool.hpp"
+#include "wav.hpp"
+#include "writer.hpp"
+
+
+// Ensemble renderer: runs --instances independent automata in the same launches, without GUI and sound server and as
+// fast as the device allows, e.g. to sweep over rules and seeds. Every instance gets its own output in --output-dir:
+// NNNN.wav with its audio, NNNN/GGGGGG.ppm with every --image-every-th visualization frame (0 for none) and, with
+// --snapshots=1, NNNN.snapshot with its state after the last frame. Options that are not handled here are passed on to
+// parse_config:
+//
+//     s2015ensemble --instances=64 --seed=7 --rule-jitter=0.2 --generations=5000 --output-dir=sweep
+//
+// Without --scenes, instance i starts from the demo scene with its seed cell at a random position and every nonzero rule
+// weight scaled by a random factor in [1 - rule-jitter, 1 + rule-jitter], both drawn from --seed + i. --scenes names a
+// file with one snapshot per line instead (one instance each, they must agree on n, m and their clocks), the ensemble
+// continues from their generation count and audio clock.
+// Files are written by a background thread, at most --writer-buffer MiB wait for it before the device is held up.
+
+
+namespace {
+
+struct ensemble_config_t {
+    std::size_t instances = 8;
+    double seconds = 10.;
+    std::size_t generations = 0; // overrides seconds if set
+    std::string scenes;
+    std::size_t seed = 1;
+    double rule_jitter = 0.1;
+    std::string output_dir = "ensemble";
+    std::size_t image_every = 0;
+    std::size_t snapshots = 0;
+    std::size_t writer_buffer = 256;
+    std::size_t platform = 0;
+    std::size_t device = 0;
+};
+
+// splits the arguments into ensemble options and the ones for parse_config
+ensemble_config_t parse_ensemble_config(int argc, char** argv, std::vector<char*>& rest) {
+    ensemble_config_t ensemble;
+    tool_options_t options = {
+        {"instances", [&](const std::string& v) { ensemble.instances = parse_size("instances", v); }},
+        {"seconds", [&](const std::string& v) { ensemble.seconds = parse_double("seconds", v); }},
+        {"generations", [&](const std::string& v) { ensemble.generations = parse_size("generations", v); }},
+        {"scenes", [&](const std::string& v) { ensemble.scenes = v; }},
+        {"seed", [&](const std::string& v) { ensemble.seed = parse_size("seed", v); }},
+        {"rule-jitter", [&](const std::string& v) { ensemble.rule_jitter = parse_double("rule-jitter", v); }},
+        {"output-dir", [&](const std::string& v) { ensemble.output_dir = v; }},
+        {"image-every", [&](const std::string& v) { ensemble.image_every = parse_size("image-every", v); }},
+        {"snapshots", [&](const std::string& v) { ensemble.snapshots = parse_size("snapshots", v); }},
+        {"writer-buffer", [&](const std::string& v) { ensemble.writer_buffer = parse_size("writer-buffer", v); }},
+        {"platform", [&](const std::string& v) { ensemble.platform = parse_size("platform", v); }},
+        {"device", [&](const std::string& v) { ensemble.device = parse_size("device", v); }}
+    };
+
+    split_tool_options("ensemble", options, argc, argv, rest);
+    myassert(ensemble.instances > 0, "instances must be positive");
+    myassert(ensemble.generations > 0 || ensemble.seconds > 0., "seconds or generations must be positive");
+    myassert(ensemble.rule_jitter >= 0., "rule-jitter must not be negative");
+    myassert(!ensemble.output_dir.empty(), "output-dir must be set");
+    return ensemble;
+}
+
+std::string instance_path(const std::string& dir, std::size_t instance, const char* suffix) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%04zu%s", instance, suffix);
+    return dir + name;
+}
+
+// the demo scene with the seed cell moved and the rule weights scaled, reproducible from `seed`
+scene_t make_jittered_scene(std::size_t n, std::size_t m, std::size_t seed, double jitter) {
+    scene_t scene = make_demo_scene(n, m);
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<std::size_t> cell(0, n * n - 1);
+    std::uniform_real_distribution<double> factor(1. - jitter, 1. + jitter);
+
+    scene.state[0] = 0.f;
+    scene.state[cell(rng) * m] = 1.f;
+    for (std::size_t i = 0; i < RIDX_BASE(m, 0); ++i) {
+        if (scene.rules[i] != 0.f) {
+            scene.rules[i] = static_cast<float>(scene.rules[i] * factor(rng));
+        }
+    }
+    return scene;
+}
+
+void run(const config_t& config, const ensemble_config_t& options, const cl::Context& context, const cl::Device& device, const std::shared_ptr<spdlog::logger>& log, const std::vector<scene_t>& scenes, std::uint64_t start_generations, float start_t) {
+    std::size_t n = config.n;
+    std::size_t nsamples = config.nsamples;
+    std::size_t instances = scenes.size();
+    std::size_t frames = options.generations > 0
+        ? options.generations
+        : static_cast<std::size_t>(std::ceil(options.seconds * static_cast<double>(config.sample_rate) / static_cast<double>(nsamples)));
+    log->info() << "render " << frames << " generations of " << instances << " instances";
+
+    Ensemble ensemble(config, context, device, log, scenes, options.image_every > 0);
+    ensemble.set_clock(start_generations, start_t);
+
+    // the outputs are only touched by the writer thread once set up, which finishes before they are destroyed
+    makeDirectories(options.output_dir);
+    std::vector<std::shared_ptr<WavWriter>> wavs;
+    for (std::size_t i = 0; i < instances; ++i) {
+        wavs.push_back(std::make_shared<WavWriter>(instance_path(options.output_dir, i, ".wav"), config.sample_rate));
+        if (options.image_every > 0) {
+            makeDirectories(instance_path(options.output_dir, i, ""));
+        }
+    }
+    BackgroundWriter writer(options.writer_buffer << 20);
+
+    std::size_t retired = 0;
+    float device_time = 0.f;
+    std::uint64_t generations = start_generations;
+    float t = start_t;
+    ensemble.set_frame_callback([&](const ensemble_frame_t& frame) {
+        ++retired;
+        device_time += frame.stats.automaton + frame.stats.visualize + frame.stats.render + frame.stats.reduce;
+        generations = frame.generation;
+        t = frame.t + static_cast<float>(nsamples) / static_cast<float>(config.sample_rate);
+
+        auto samples = std::make_shared<std::vector<float>>(frame.samples, frame.samples + instances * nsamples);
+        writer.post(sizeof(float) * samples->size(), [&wavs, samples, nsamples]() {
+            for (std::size_t i = 0; i < wavs.size(); ++i) {
+                wavs[i]->write(samples->data() + i * nsamples, nsamples);
+            }
+        });
+
+        std::size_t image = static_cast<std::size_t>(frame.generation - 1);
+        if (frame.textures && (frame.generation - start_generations - 1) % options.image_every == 0) {
+            auto pixels = std::make_shared<std::vector<unsigned char>>(frame.textures, frame.textures + 4 * n * n * instances);
+            std::string dir = options.output_dir;
+            writer.post(pixels->size(), [pixels, image, n, instances, dir]() {
+                char name[32];
+                std::snprintf(name, sizeof(name), "/%06zu.ppm", image);
+                for (std::size_t i = 0; i < instances; ++i) {
+                    write_ppm(instance_path(dir, i, "") + name, pixels->data() + 4 * n * n * i, n);
+                }
+            });
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    while (retired < frames) {
+        if (!ensemble.poll(frames)) {
+            std::this_thread::yield();
+        }
+    }
+    ensemble.drain();
+    if (options.snapshots) {
+        log->info() << "snapshots to " << options.output_dir;
+        auto states = std::make_shared<std::vector<std::vector<float>>>(ensemble.read_states());
+        std::string dir = options.output_dir;
+        std::size_t m = config.m;
+        writer.post(sizeof(float) * instances * n * n * m, [states, &scenes, dir, n, m, generations, t]() {
+            for (std::size_t i = 0; i < states->size(); ++i) {
+                writeSnapshot(instance_path(dir, i, ".snapshot"), n, m, (*states)[i].data(), scenes[i], generations, t);
+            }
+        });
+    }
+    double compute = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writer.finish();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double instance_generations = static_cast<double>(frames * instances);
+    log->info() << "done after " << wall << "s (" << compute << "s compute), " << instance_generations / compute << " instance generations per second, " << device_time / static_cast<float>(frames) << "ms device time per frame, writer stalled " << writer.stalls() << " times";
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    auto log = spdlog::stderr_logger_mt("ensemble");
+
+    try {
+        std::vector<char*> rest;
+        ensemble_config_t options = parse_ensemble_config(argc, argv, rest);
+        config_t config = parse_config(static_cast<int>(rest.size()), rest.data());
+
+        std::vector<scene_t> scenes;
+        std::uint64_t generations = 0;
+        float t = 0.f;
+        if (!options.scenes.empty()) {
+            std::ifstream file(options.scenes.c_str());
+            myassert(file.good(), "cannot open " + options.scenes);
+            std::string path;
+            while (std::getline(file, path)) {
+                if (path.empty()) {
+                    continue;
+                }
+                MappedSnapshot snapshot(path);
+                if (scenes.empty()) {
+                    config.n = snapshot.n();
+                    config.m = snapshot.m();
+                    generations = snapshot.generations();
+                    t = snapshot.t();
+                }
+                myassert(snapshot.n() == config.n && snapshot.m() == config.m, "the snapshots of an ensemble must agree on n and m: " + path);
+                myassert(snapshot.generations() == generations && snapshot.t() == t, "the snapshots of an ensemble must agree on their clocks: " + path);
+                scene_t scene = snapshot.scene();
+                scene.state.assign(snapshot.state(), snapshot.state() + config.n * config.n * config.m);
+                scenes.push_back(std::move(scene));
+            }
+            myassert(!scenes.empty(), "no snapshots in " + options.scenes);
+            log->info() << "loaded " << scenes.size() << " scenes from " << options.scenes;
+        } else {
+            for (std::size_t i = 0; i < options.instances; ++i) {
+                scenes.push_back(make_jittered_scene(config.n, config.m, options.seed + i, options.rule_jitter));
+            }
+        }
+
+        log->debug() << "get platform and device";
+        cl::Device device = tool_devices(tool_platforms(), options.platform, options.device).front();
+        cl::Context context(std::vector<cl::Device>{device});
+
+        run(config, options, context, device, log, scenes, generations, t);
+    } catch (const cl::Error& e) {
+        log->error() << e.what() << " (" << e.err() << ")";
+        return EXIT_FAILURE;
+    } catch (const std::exception& e) {
+        log->error() << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+struct FreeDeleter {
+    void operator()(void* p) const {
+        std::free(p);
+    }
+};
+
+template <typename T>
+using aligned_ptr_t = std::unique_ptr<T[], FreeDeleter>;
+
+// zero-initialized heap array, page-aligned by default so it can back CL_MEM_USE_HOST_PTR buffers without copies
+template <typename T>
+aligned_ptr_t<T> make_aligned(std::size_t count, std::size_t alignment = 4096) {
+    void* p = nullptr;
+    std::size_t bytes = sizeof(T) * (count > 0 ? count : 1);
+    if (posix_memalign(&p, alignment, bytes) != 0) {
+        throw std::bad_alloc();
+    }
+    T* data = static_cast<T*>(p);
+    for (std::size_t i = 0; i < count; ++i) {
+        new (data + i) T();
+    }
+    return aligned_ptr_t<T>(data);
+}
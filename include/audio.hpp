@@ -1,5 +1,96 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <string>
+
 #include "common.hpp"
+#include "config.hpp"
+#include "wav.hpp"
+
+// snapshot of what a sink measured so far
+struct audio_metrics_t {
+    double latency_ms = 0.;  // estimated time from publishing a block to playing its first sample
+    double target_ms = 0.;   // queue depth the producer currently aims for
+    std::size_t underruns = 0; // blocks the sink played as silence after playback started, plus the times the server ran dry
+    std::size_t samples = 0; // played so far, silence included
+};
+
+// Consumer side of the audiobuffer. Backends pull samples when their device needs them, so the queue only has to cover
+// the jitter of the producer. The fill target of the audiobuffer starts at `queue_ms` and grows by half whenever the
+// queue runs dry, it shrinks back by one block after every ten seconds without an underrun. Every block that is played
+// as silence counts as one underrun, so a long gap weighs more than a short one.
+class AudioSink {
+    public:
+        virtual ~AudioSink() = default;
+
+        AudioSink(const AudioSink&) = delete;
+        AudioSink& operator=(const AudioSink&) = delete;
+
+        // plays until `shutdown` is set, call from the audio thread only
+        virtual void run(const shared_atomic_t<bool>& shutdown) = 0;
+
+        // may be called from any thread
+        audio_metrics_t metrics() const;
+
+    protected:
+        AudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log, std::size_t queue_ms);
+
+        // fills `out` with the next `count` samples from the audiobuffer and silence where it runs dry, must only be
+        // called from one thread at a time
+        void pull(float* out, std::size_t count);
+
+        // samples the backend holds between `pull` and the speaker
+        void set_backend_latency(std::size_t samples);
+
+        // the backend ran dry on its own, e.g. the server did not get the samples in time
+        void note_backend_underrun();
+
+        const std::size_t sample_rate;
+        std::shared_ptr<spdlog::logger> log;
+
+    private:
+        shared_buffer_t<float> audiobuffer;
+        std::size_t min_blocks;
+        bool started = false;        // the first block arrived, underruns before are the startup latency
+        bool starved = false;        // the last pull ran dry, so the fill target grew for the current gap already
+        std::size_t gap_samples = 0; // silence played in the current gap, every started block counts as an underrun
+        std::size_t calm_samples = 0; // played since the last underrun or shrink
+
+        std::atomic<std::size_t> backend_samples{0};
+        std::atomic<std::size_t> read_offset{0}; // samples of the current block that were already pulled
+        std::atomic<std::size_t> played_samples{0};
+        std::atomic<std::size_t> backend_underruns{0};
+};
+
+// discards the samples at the sample rate of a simulated sound card, which pulls one block at a time
+class NullAudioSink : public AudioSink {
+    public:
+        NullAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log);
+
+        void run(const shared_atomic_t<bool>& shutdown) override;
+
+    protected:
+        // receives every played block
+        virtual void consume(const float* /*data*/, std::size_t /*count*/) {}
+
+    private:
+        std::size_t period;
+};
+
+// plays like NullAudioSink and writes everything that was played to a mono 32 bit float WAV file
+class WavAudioSink : public NullAudioSink {
+    public:
+        WavAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log);
+
+    protected:
+        void consume(const float* data, std::size_t count) override;
+
+    private:
+        WavWriter wav;
+};
+
+std::unique_ptr<AudioSink> makeAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log);
 
-void main_audio(std::size_t samplerate, shared_mutex_t mGlobal, shared_atomic_t<bool> shutdown, shared_buffer_t<float> audiobuffer);
+// entry point of the audio thread, sets `shutdown` when the sink fails
+void main_audio(std::shared_ptr<AudioSink> sink, std::shared_ptr<spdlog::logger> log, shared_atomic_t<bool> shutdown);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+
+// time of every stage in ms (device time summed over all bands for OpenCL, host time for the CPU backend), plus the
+// host time from submitting the frame until it was retired
+struct frame_stats_t {
+    float automaton = 0.f;
+    float visualize = 0.f;
+    float halo = 0.f;
+    float render = 0.f;
+    float reduce = 0.f;
+    float download = 0.f;
+    float host = 0.f;
+    std::size_t active_tiles = 0; // tiles computed by the sparse automaton kernel
+};
+
+// the state after one frame as downloaded, with the generations computed up to it and the time of the next sample
+struct state_snapshot_t {
+    std::uint64_t generations = 0;
+    float t = 0.f;
+    std::size_t bytes = 0; // held by `decode`
+    std::function<std::vector<float>()> decode; // the whole grid, interleaved, may be called from any thread
+};
+
+// Advances the automaton by `generations_per_launch` generations per frame and publishes every frame in order to
+// `hTexture` (a triple buffer read by the GUI) and `audiobuffer`.
+class Backend {
+    public:
+        virtual ~Backend() = default;
+
+        // retires finished frames and submits a new one if the audiobuffer has room, returns false if there was
+        // nothing to do
+        virtual bool poll() = 0;
+
+        // waits for all frames in flight and retires them
+        virtual void drain() = 0;
+
+        // submits one frame and waits until it is retired, the audiobuffer must have room for it
+        virtual void step() = 0;
+
+        // waits for all frames in flight and returns the current state of the whole grid, interleaved
+        virtual std::vector<float> read_state() = 0;
+
+        // called with the profiling data of every retired frame
+        virtual void set_stats_callback(std::function<void(const frame_stats_t&)> callback) = 0;
+
+        // copies the state of the newest submitted frame without waiting for the device. `callback` is called by
+        // `poll` or `drain` when that frame is retired, or right away if no frame is in flight
+        virtual void request_snapshot(std::function<void(state_snapshot_t)> callback) = 0;
+
+        // continues the generation count and the audio clock of a snapshot, call before the first frame
+        virtual void set_clock(std::uint64_t generations, float t) = 0;
+
+        // `poll` submits no more than `frames` frames in total, e.g. so that a render stops exactly at its end. 0 for
+        // no limit, `step` ignores it
+        virtual void set_frame_limit(std::size_t frames) = 0;
+};
+
+// the backend selected by config.backend, `context` and `devices` are only used by the OpenCL one. `hState` holds
+// n * n * m values, interleaved, and is only read during construction
+std::unique_ptr<Backend> makeBackend(
+    const config_t& config,
+    const cl::Context& context,
+    const std::vector<cl::Device>& devices,
+    const std::shared_ptr<spdlog::logger>& log,
+    const float* hState,
+    const std::vector<float>& hRules,
+    const std::vector<float>& hFrequencies,
+    const std::vector<float>& hColors,
+    const shared_texture_t& hTexture,
+    const shared_buffer_t<float>& audiobuffer
+);
@@ -3,14 +3,13 @@
 #include <atomic>
 #include <exception>
 #include <memory>
-#include <mutex>
-#include <queue>
 #include <string>
 #include <vector>
 
 #include <spdlog/spdlog.h>
 
-using shared_mutex_t = std::shared_ptr<std::mutex>;
+#include "ringbuffer.hpp"
+#include "triplebuffer.hpp"
 
 template <typename T>
 using shared_mem_t = std::shared_ptr<std::vector<T>>;
@@ -18,9 +17,22 @@ using shared_mem_t = std::shared_ptr<std::vector<T>>;
 template <typename T>
 using shared_atomic_t = std::shared_ptr<std::atomic<T>>;
 
-// TODO: use lock-free queue instead
 template <typename T>
-using shared_buffer_t = std::shared_ptr<std::queue<std::vector<T>>>;
+using shared_buffer_t = std::shared_ptr<SpscRing<T>>;
+
+// frame handed from the compute loop to the GUI, `data` stays valid while the view sits in the triple buffer
+struct texture_view_t {
+    const unsigned char* data = nullptr;
+    std::size_t version = 0;
+    std::size_t slot = 0; // owned by the producer
+};
+
+using shared_texture_t = std::shared_ptr<TripleBuffer<texture_view_t>>;
+
+constexpr bool is_power_of_2(std::size_t v) {
+    // see https://graphics.stanford.edu/~seander/bithacks.html#DetermineIfPowerOf2
+    return v && !(v & (v - 1));
+}
 
 class MyException : public std::exception {
     public:
@@ -33,6 +45,13 @@ class MyException : public std::exception {
         std::string msg;
 };
 
+// debug output of the per-frame loops, only compiled in with -DHOT_DEBUG_LOG=ON and then filtered by the logger level
+#ifdef S2015_HOT_DEBUG_LOG
+#define HOT_DEBUG(log, msg) ((log)->debug() << msg)
+#else
+#define HOT_DEBUG(log, msg) ((void)0)
+#endif
+
 inline void myassert(bool test, const std::string& msg) {
     if (!test) {
         throw MyException(msg);
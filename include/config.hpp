@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+
+#include "common.hpp"
+
+enum class backend_t {
+    opencl, // the Pipeline on one OpenCL device per band
+    cpu     // native threads and SIMD loops, no OpenCL runtime needed
+};
+
+enum class render_mode_t {
+    samples, // render every cell to sample blocks, then reduce them
+    levels   // reduce the state to per-level amplitudes, then synthesize
+};
+
+enum class automaton_kernel_t {
+    generic,    // one work-item per cell and level
+    tiled,      // one work-item per cell, work-groups share a local memory tile
+    specialized, // generated at startup with the nonzero rules as literals, falls back to generic for dense rules
+    sparse,      // tiled, but only for tiles whose neighbourhood changed in the last generation
+    fused        // tiled, and also writes the texture and the per-level sums (render_mode levels only)
+};
+
+enum class queue_mode_t {
+    in_order,     // one in-order queue for kernels and downloads
+    out_of_order, // one out-of-order queue, ordered by events only
+    split         // in-order compute queue plus a separate transfer queue
+};
+
+enum class output_memory_t {
+    copy,           // device buffers, results are downloaded with enqueueReadBuffer
+    alloc_host_ptr, // textures in CL_MEM_ALLOC_HOST_PTR buffers, audio in the ring (CL_MEM_USE_HOST_PTR), map/unmap
+    use_host_ptr    // textures and audio in host memory via CL_MEM_USE_HOST_PTR, map/unmap
+};
+
+enum class state_format_t {
+    fp32,    // full float
+    fp16,    // half precision via vload_half / vstore_half
+    unorm16, // 16 bit fixed point in [0, 1]
+    unorm8   // 8 bit fixed point in [0, 1]
+};
+
+enum class state_layout_t {
+    interleaved, // the levels of a cell are neighbours in memory
+    planar       // one contiguous plane per level, cells along x are neighbours in memory
+};
+
+enum class audio_sink_t {
+    pulse, // PulseAudio, the server pulls the samples when it needs them
+    null,  // discards the samples at the pace of a simulated sound card clock
+    wav    // like null, but writes the samples to audio_file
+};
+
+enum class device_fission_t {
+    none,   // use the devices of the platform as they are
+    numa,   // split every device into one sub-device per NUMA node
+    equally // split every device into `bands` sub-devices with the same number of compute units
+};
+
+struct config_t {
+    backend_t backend = backend_t::opencl;
+    std::size_t cpu_threads = 0; // including the compute thread, 0 for one per hardware thread
+    std::size_t cpu_block_rows = 8; // rows per task of the CPU backend
+    std::size_t cpu_tile = 256; // columns per cache block of the CPU automaton, rounded up to whole vectors
+    std::size_t n = 16;
+    std::size_t m = 4;
+    std::size_t reduction_size = 16;
+    std::size_t sample_rate = 44100;
+    std::size_t nsamples = 1024;
+    render_mode_t render_mode = render_mode_t::levels;
+    std::size_t render_chunk = 262144; // cells per render launch in samples mode, bounds the scratch buffers
+    automaton_kernel_t automaton_kernel = automaton_kernel_t::specialized;
+    std::size_t automaton_tile = 8;
+    std::size_t local_width = 0; // work-group size of the untiled automaton and the visualize kernels along x, 0 lets the runtime choose
+    std::size_t local_height = 0; // and along y, set both or neither
+    std::size_t render_group = 32; // work-items per work-group of the render and synthesize kernels
+    std::size_t reduce_lanes = 32; // blocks or cells folded in parallel per reduce and amplitudes work-group, power of 2
+    float rules_dense_threshold = 0.25f;
+    std::size_t generations_per_launch = 1;
+    std::size_t frames_in_flight = 2;
+    queue_mode_t queue_mode = queue_mode_t::split;
+    output_memory_t output_memory = output_memory_t::copy;
+    state_format_t state_format = state_format_t::fp32; // storage only, the generations of one temporal launch stay float
+    state_layout_t state_layout = state_layout_t::interleaved;
+    std::size_t state_vector = 4; // cells per work-item of the planar kernels along x: 1, 4 or 8
+    std::size_t bands = 1; // horizontal bands of the grid, each on its own device
+    device_fission_t device_fission = device_fission_t::none;
+    audio_sink_t audio_sink = audio_sink_t::pulse;
+    std::size_t audio_latency = 50; // target time from publishing a block to playing it in ms, grows after underruns
+    std::string audio_file = "s2015ocl.wav";
+    std::string program_cache; // directory for compiled program binaries, empty disables the cache
+    std::string tuning_file; // launch profiles per device written by `s2015bench --tune=1`, empty disables them
+    std::string resume; // snapshot to start from instead of the demo scene, its n and m are used
+    std::string snapshot_file; // written at exit, on SIGUSR2 and every snapshot_interval, empty disables snapshots
+    std::size_t snapshot_interval = 0; // seconds between snapshots while running, 0 for none
+    std::size_t profiling_interval = 1000; // frames between the profiling log lines of the OpenCL backend, 0 for none
+    std::string trace_file; // Chrome trace JSON written at exit and on SIGUSR1, empty disables tracing
+    std::size_t trace_events = 1 << 20; // per thread, later ones are dropped
+};
+
+// parses `--key=value` command line arguments, throws MyException on bad input
+config_t parse_config(int argc, char** argv);
+
+// the whole of `value` as a number, throws MyException naming `key` otherwise
+std::size_t parse_size(const std::string& key, const std::string& value);
+float parse_float(const std::string& key, const std::string& value);
+double parse_double(const std::string& key, const std::string& value);
+
+// applies one `--key=value` argument on top of `config`, throws MyException on bad input
+void set_config_option(config_t& config, const std::string& arg);
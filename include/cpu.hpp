@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "aligned.hpp"
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "threadpool.hpp"
+
+// Native implementation of the automaton, visualize and audio stages for machines without an OpenCL runtime. Every
+// stage runs on a ThreadPool over blocks of `cpu_block_rows` rows, and the automaton walks every block in tiles of
+// `cpu_tile` columns, so the three input rows of a tile stay in the L1 cache while its rows are computed. The state is
+// stored as one plane per level with a padding column on either side that mirrors the opposite edge, so the inner loops
+// load whole vectors of neighbouring cells without wrapping. The automaton sums in the same order and, as long as
+// src/cpu.cpp is built without floating-point contraction (see CMakeLists.txt), with the same rounding as the OpenCL
+// kernels, the audio is always synthesized from per-level amplitudes (render_mode only changes the rounding on a
+// device). Frames are computed synchronously by `poll` and `step`, the state is always stored as fp32.
+class CpuBackend : public Backend {
+    public:
+        CpuBackend(
+            const config_t& config,
+            const std::shared_ptr<spdlog::logger>& log,
+            const float* hState,
+            const std::vector<float>& hRules,
+            const std::vector<float>& hFrequencies,
+            const std::vector<float>& hColors,
+            const shared_texture_t& hTexture,
+            const shared_buffer_t<float>& audiobuffer
+        );
+
+        bool poll() override;
+        void drain() override;
+        void step() override;
+        std::vector<float> read_state() override;
+        void set_stats_callback(std::function<void(const frame_stats_t&)> callback) override;
+        void request_snapshot(std::function<void(state_snapshot_t)> callback) override;
+        void set_clock(std::uint64_t generations, float t) override;
+        void set_frame_limit(std::size_t frames) override;
+
+    private:
+        config_t config;
+        std::shared_ptr<spdlog::logger> log;
+        shared_texture_t hTexture;
+        shared_buffer_t<float> audiobuffer;
+        std::size_t n;
+        std::size_t m;
+        std::size_t stride; // floats per row of a plane, including the padding columns
+        std::size_t tile;
+        std::size_t nblocks;
+        ThreadPool pool;
+
+        std::vector<float> rules;
+        std::vector<float> frequencies;
+        std::vector<float> colors;
+        aligned_ptr_t<float> state[2]; // m planes of n rows each, state[flipflop] is the current one
+        std::vector<float> partial;    // per-level sums of every generation and row block
+        std::vector<float> amplitudes;
+
+        // the GUI holds up to two textures in `hTexture`, the third one gets written
+        std::vector<aligned_ptr_t<unsigned char>> textures;
+        std::vector<std::size_t> textures_free;
+
+        bool flipflop = false;
+        float t = 0.f;
+        std::uint64_t generations = 0; // computed so far
+        std::size_t frames_published = 0;
+        std::size_t frame_limit = 0;
+        std::function<void(const frame_stats_t&)> stats_callback;
+
+        bool has_room() const;
+        void launch();
+        float* plane(std::size_t parity, std::size_t level, std::size_t row) const;
+        void automaton_rows(std::size_t parity, std::size_t y0, std::size_t y1, float* sums) const;
+        void visualize_rows(std::size_t parity, std::size_t y0, std::size_t y1, unsigned char* texture) const;
+        void synthesize(std::size_t generation, float* out);
+};
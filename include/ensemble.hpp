@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+#include "scene.hpp"
+#include "stages.hpp"
+
+// the results of one frame of all instances, the pointers are valid during the callback only
+struct ensemble_frame_t {
+    std::uint64_t generation = 0; // counted from 1
+    float t = 0.f; // time of the first sample
+    const float* samples = nullptr; // nsamples per instance, one instance after the other
+    const unsigned char* textures = nullptr; // 4 * n * n bytes per instance, null if disabled
+    frame_stats_t stats;
+};
+
+// Runs independent automata of the same size side by side, one per scene, e.g. for a sweep over rules and seeds. The
+// states, rules, frequencies and audio outputs of all instances are packed into the same buffers (see INSTANCES in
+// state.cl), so every stage is a single launch whose dimension 2 selects the instance, and even small grids fill the
+// device. All instances share the colors of the first scene.
+//
+// There is no GUI and no audio sink, every retired frame is handed to the frame callback instead. As in the Pipeline,
+// up to `frames_in_flight` frames are queued at once: the stages run on an in-order compute queue and the downloads of a
+// frame on a transfer queue, so they overlap with the next frames. Only the generic automaton kernel is batched, on a
+// single device and with one generation per launch.
+class Ensemble {
+    public:
+        Ensemble(
+            const config_t& config,
+            const cl::Context& context,
+            const cl::Device& device,
+            const std::shared_ptr<spdlog::logger>& log,
+            const std::vector<scene_t>& scenes,
+            bool textures
+        );
+
+        // waits for the downloads of the frames in flight, without handing them to the frame callback
+        ~Ensemble();
+
+        // retires finished frames and submits new ones until `limit` frames were submitted in total, returns false if
+        // there was nothing to do
+        bool poll(std::size_t limit);
+
+        // waits for all frames in flight and retires them
+        void drain();
+
+        // waits for all frames in flight and returns the current state of every instance, interleaved
+        std::vector<std::vector<float>> read_states();
+
+        // called with the results of every retired frame, in order
+        void set_frame_callback(std::function<void(const ensemble_frame_t&)> callback);
+
+        // continues the generation count and the audio clock of the scenes, call before the first frame
+        void set_clock(std::uint64_t generations, float t);
+
+        std::size_t instances() const {
+            return ninstances;
+        }
+
+    private:
+        struct frame_t {
+            cl::Buffer dSamples;
+            cl::Buffer dTextures;
+            std::vector<float> samples;
+            std::vector<unsigned char> textures;
+            std::uint64_t generation = 0;
+            float t = 0.f;
+            std::chrono::steady_clock::time_point submitted;
+
+            std::vector<cl::Event> evts_automaton;
+            std::vector<cl::Event> evts_visualize;
+            std::vector<cl::Event> evts_render;
+            std::vector<cl::Event> evts_reduce;
+            std::vector<cl::Event> evts_download;
+        };
+
+        config_t config;
+        std::shared_ptr<spdlog::logger> log;
+        std::size_t ninstances;
+        bool with_textures;
+        std::size_t ngroups = 0; // partial blocks (samples mode) or sums (levels mode) per instance
+
+        cl::CommandQueue queueCompute;
+        cl::CommandQueue queueTransfer;
+
+        // one kernel object per parity of the state buffers, their buffer arguments are set once
+        cl::Kernel kernelAutomaton[2];
+        cl::Kernel kernelVisualize[2];
+        cl::Kernel kernelRender[2];
+        cl::Kernel kernelAmplitudes[2];
+        cl::Kernel kernelReduce;
+        cl::Kernel kernelSynthesize;
+        cl::NDRange automatonLocal;
+        cl::NDRange visualizeLocal;
+
+        cl::Buffer dState0;
+        cl::Buffer dState1;
+        cl::Buffer dRules;
+        cl::Buffer dFrequencies;
+        cl::Buffer dColors;
+        cl::Buffer dBuffer0; // rendered blocks of one chunk, samples mode only
+        cl::Buffer dBuffer1; // partial blocks, samples mode only
+        cl::Buffer dPartial; // partial sums, levels mode only
+
+        FrameRing<frame_t> frames;
+        std::vector<cl::Event> wait_audio; // kept between frames so that their storage is reused
+        std::vector<cl::Event> wait_download;
+
+        bool flipflop = false;
+        float t = 0.f;
+        std::uint64_t generations = 0;
+        std::function<void(const ensemble_frame_t&)> frame_callback;
+
+        void submit();
+        void retire();
+};
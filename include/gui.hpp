@@ -2,4 +2,4 @@
 
 #include "common.hpp"
 
-void main_gui(std::size_t n, std::size_t m, shared_mutex_t mGlobal, shared_mem_t<unsigned char> hTexture, shared_atomic_t<bool> shutdown);
+void main_gui(std::size_t n, std::size_t m, shared_texture_t hTexture, shared_atomic_t<bool> shutdown);
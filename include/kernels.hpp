@@ -0,0 +1,7 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// OpenCL sources, embedded at build time by cmake/embed.cmake and keyed by file name (e.g. "render.cl")
+const std::map<std::string, std::string>& embeddedKernelSources();
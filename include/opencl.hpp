@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include "common.hpp"
+
+// builds `sourceCode` for all devices. With a non-empty `cacheDir`, program binaries are loaded from and stored to that
+// directory, keyed on device name, driver version, options and a hash of the source. Mismatching or rejected binaries
+// fall back to a source build.
+cl::Program buildProgramFromSource(const std::string& sourceCode, const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options = "", const std::string& cacheDir = "");
+
+// same for the concatenation of embedded kernel sources, e.g. {"state.cl", "render.cl"}
+cl::Program buildProgramFromEmbedded(const std::vector<std::string>& names, const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options = "", const std::string& cacheDir = "");
+float getEventTimeMS(const cl::Event& evt);
+
+// creates `path` and all missing parent directories
+void makeDirectories(const std::string& path);
+
+// a name next to `path` for writing a file that is then renamed over `path`, unique between threads and processes
+std::string tempPath(const std::string& path);
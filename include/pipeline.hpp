@@ -0,0 +1,212 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "aligned.hpp"
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+#include "rulegen.hpp"
+#include "stages.hpp"
+
+// Runs the automaton, visualize and render stages. Up to `frames_in_flight` launches are queued at once, ordered by
+// event dependencies instead of `queue.finish()`, so the device computes the next generation while the results of the
+// previous ones are downloaded. Finished frames are published in order to `hTexture` (a triple buffer read by the GUI)
+// and `audiobuffer`. With `output_memory` set to a host pointer mode, kernels write to buffers that live in host memory
+// (the audio ring itself and a pool of textures) and results are handed out via map/unmap instead of being copied.
+//
+// With `bands` > 1, the grid is split into horizontal bands, one per device. Every band stores a halo row above and
+// below its own rows, which is filled from the neighbouring bands (wrapping around) after every generation: each band
+// downloads its first and last row into its own host staging area and the neighbours upload them from there, so no
+// buffer is accessed by two devices. The audio
+// partials of all bands are gathered on the first device, which finishes the audio block, and every band downloads its
+// rows of the texture straight into the host image.
+class Pipeline : public Backend {
+    public:
+        Pipeline(
+            const config_t& config,
+            const cl::Context& context,
+            const std::vector<cl::Device>& devices,
+            const std::shared_ptr<spdlog::logger>& log,
+            const float* hState,
+            const std::vector<float>& hRules,
+            const std::vector<float>& hFrequencies,
+            const std::vector<float>& hColors,
+            const shared_texture_t& hTexture,
+            const shared_buffer_t<float>& audiobuffer
+        );
+
+        // drains the frames in flight and unmaps the outputs
+        ~Pipeline() override;
+
+        bool poll() override;
+        void drain() override;
+        void step() override;
+        std::vector<float> read_state() override;
+        void set_stats_callback(std::function<void(const frame_stats_t&)> callback) override;
+        void request_snapshot(std::function<void(state_snapshot_t)> callback) override;
+        void set_clock(std::uint64_t generations, float t) override;
+        void set_frame_limit(std::size_t frames) override;
+
+        // audiobuffer size that fits half a second of audio plus all frames in flight, in whole launches
+        static std::size_t audiobuffer_blocks(const config_t& config);
+
+        // local memory per work-group of the tiled automaton kernels, 0 for the untiled ones
+        static std::size_t automaton_local_bytes(const config_t& config);
+
+        // the rows of every band, whole tiles for the tiled automaton kernels
+        static std::vector<std::size_t> band_rows(const config_t& config);
+
+        // one device per band: the first `bands` of `available`, after splitting them via device fission if configured
+        static std::vector<cl::Device> select_devices(const config_t& config, const std::vector<cl::Device>& available);
+
+    private:
+        // the GUI holds up to two textures in `hTexture`, the others are free or used by frames in flight
+        struct texture_t {
+            std::vector<cl::Buffer> dTextures; // the rows of every band, one buffer for the whole texture if mapped
+            aligned_ptr_t<unsigned char> host; // download target, or backing store for CL_MEM_USE_HOST_PTR
+            unsigned char* mapped = nullptr;
+        };
+
+        // sub-buffer of the audio ring that holds the blocks of one frame
+        struct audio_chunk_t {
+            cl::Buffer dSamples;
+            void* mapped = nullptr;
+        };
+
+        struct frame_t {
+            cl::Buffer dSamples; // copy mode only
+            std::size_t texture;
+            std::chrono::steady_clock::time_point submitted;
+            std::uint64_t submitted_trace = 0; // traceNow() at submit, if tracing
+
+            std::vector<cl::Event> evts_activate;
+            std::vector<cl::Event> evts_automaton; // one per band
+            std::vector<cl::Event> evts_visualize; // one per band
+            std::vector<cl::Event> evts_halo;
+            std::vector<cl::Event> evts_render;
+            std::vector<cl::Event> evts_reduce;
+            std::vector<cl::Event> evts_download;
+            cl_uint active_tiles = 0;
+
+            // a state snapshot that gets handed out once the frame is retired
+            state_snapshot_t snapshot;
+            std::function<void(state_snapshot_t)> snapshot_callback;
+        };
+
+        // one horizontal band of the grid and everything that lives on its device
+        struct band_t {
+            std::size_t y0 = 0;
+            std::size_t rows = 0;
+            std::size_t ngroups = 0;      // partial blocks (samples mode) or sums (levels mode) of this band
+            std::size_t group_offset = 0; // where they go in the combined buffer
+
+            cl::CommandQueue queueCompute;
+            cl::CommandQueue queueTransfer;
+
+            // one kernel object per parity of the state buffers, their buffer arguments are set once
+            cl::Kernel kernelAutomaton[2];
+            cl::Kernel kernelVisualize[2];
+            cl::Kernel kernelRender[2];
+            cl::Kernel kernelReduce;
+            cl::Kernel kernelAmplitudes[2];
+            cl::NDRange automatonGlobal;
+
+            cl::Buffer dState0; // own rows plus the halo rows
+            cl::Buffer dState1;
+            cl::Buffer dBuffer0;
+            cl::Buffer dBuffer1; // the combined buffer for the first band
+            cl::Buffer dPartial; // the combined buffer for the first band
+            aligned_ptr_t<unsigned char> hEdges; // the first and the last row of the band, staged for the neighbours
+
+            // dependencies between consecutive frames
+            cl::Event evt_last_automaton;
+            std::vector<cl::Event> evts_halo;
+            std::vector<cl::Event> evts_edges; // downloads into hEdges
+            std::vector<cl::Event> evts_edge_readers; // uploads from hEdges into the halo rows of the neighbours
+            std::vector<cl::Event> evts_state_readers[2];
+        };
+
+        config_t config;
+        std::vector<cl::Device> devices; // one per band
+        std::shared_ptr<spdlog::logger> log;
+        shared_texture_t hTexture;
+        shared_buffer_t<float> audiobuffer;
+        bool zero_copy;
+        std::size_t halo_rows;
+        std::size_t vector_cells; // cells along x per work-item of the planar kernels
+
+        RuleSpecializer specializer;
+        cl::Program programAutomaton;
+        std::vector<band_t> bands;
+        cl::Kernel kernelSynthesize;
+        cl::NDRange automatonLocal;
+        cl::NDRange visualizeLocal;
+
+        // sparse automaton: changed flags per tile (one set written per launch, the other read) and the active tiles
+        bool sparse = false;
+        cl::Kernel kernelActivate[2];
+        cl::Buffer dChanged[2];
+        cl::Buffer dTiles;
+        cl::Buffer dTileCount;
+
+        // fused automaton: the automaton kernel also writes the texture and the per-level sums of its band
+        bool fused = false;
+
+        cl::Buffer dRules;
+        cl::Buffer dFrequencies;
+        cl::Buffer dColors;
+        cl::Buffer dBuffer1; // partial blocks of all bands, on the first device
+        cl::Buffer dPartial; // partial sums of all bands, on the first device
+        std::size_t ngroups = 0;
+
+        std::vector<texture_t> textures;
+        std::vector<std::size_t> textures_free;
+        cl::Buffer dAudioRing;
+        std::vector<audio_chunk_t> audio_chunks;
+
+        FrameRing<frame_t> frames;
+        std::size_t frame_limit = 0;
+        std::size_t audio_reserved = 0;
+
+        // the audio scratch buffers are shared between frames
+        cl::Event evt_last_audio;
+        cl::Event evt_last_tile_count;
+
+        // wait lists of `submit`, kept between frames so that their storage is reused
+        struct wait_lists_t {
+            std::vector<cl::Event> texture_free;
+            std::vector<cl::Event> samples_free;
+            std::vector<cl::Event> automaton;
+            std::vector<cl::Event> activate;
+            std::vector<cl::Event> edges;
+            std::vector<cl::Event> above;
+            std::vector<cl::Event> below;
+            std::vector<cl::Event> visualize;
+            std::vector<cl::Event> last_audio;
+            std::vector<cl::Event> audio;
+            std::vector<cl::Event> gathered;
+            std::vector<cl::Event> download;
+        } waits;
+
+        bool flipflop = false;
+        float t = 0.f;
+        std::uint64_t generations = 0; // submitted so far
+        std::size_t profiling_counter = 0;
+        std::function<void(const frame_stats_t&)> stats_callback;
+        std::map<cl_command_queue, std::uint32_t> trace_tracks; // trace track of every queue, if tracing
+
+        // creates the automaton kernels of all bands and sets their arguments
+        void make_automaton_kernels();
+        bool has_room() const;
+        void submit();
+        void retire();
+        frame_stats_t collect_stats(const frame_t& frame) const;
+        void trace_device(const frame_t& frame) const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+
+#include <pulse/pulseaudio.h>
+
+#include "audio.hpp"
+
+// PulseAudio playback on the asynchronous API. The server asks for samples via the write callback, which runs on the
+// thread of the mainloop and pulls them from the audiobuffer. The server side buffer starts at half of `audio_latency`
+// and grows by half after every server underrun.
+class PulseAudioSink : public AudioSink {
+    public:
+        PulseAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log);
+        ~PulseAudioSink() override;
+
+        void run(const shared_atomic_t<bool>& shutdown) override;
+
+    private:
+        static void on_context_state(pa_context* c, void* userdata);
+        static void on_stream_state(pa_stream* s, void* userdata);
+        static void on_write(pa_stream* s, std::size_t nbytes, void* userdata);
+        static void on_underflow(pa_stream* s, void* userdata);
+
+        void throw_error(const char* what);
+        void close();
+
+        pa_sample_spec spec;
+        std::size_t max_tlength;
+        pa_threaded_mainloop* mainloop = nullptr;
+        pa_context* context = nullptr;
+        pa_stream* stream = nullptr;
+        std::atomic<bool> failed{false}; // set by the callbacks, they cannot throw
+        bool named = false; // the mainloop thread is named in the trace
+};
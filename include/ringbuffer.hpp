@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+#include "aligned.hpp"
+
+// Fixed-capacity single-producer/single-consumer ring of equally sized blocks. All storage is allocated up front, both
+// sides are wait-free. The producer fills the next free blocks via `write_block(offset)` and publishes them with
+// `commit_write`, the consumer reads `read_block()` and hands it back with `commit_read`. The storage is one
+// page-aligned array, so it can be shared with a device via CL_MEM_USE_HOST_PTR.
+template <typename T>
+class SpscRing {
+    public:
+        SpscRing(std::size_t capacity, std::size_t block_size)
+            : capacity(capacity),
+              bsize(block_size),
+              storage(make_aligned<T>(capacity * block_size)) {}
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        std::size_t blocks() const {
+            return capacity;
+        }
+
+        std::size_t block_size() const {
+            return bsize;
+        }
+
+        T* data() {
+            return storage.get();
+        }
+
+        // number of published blocks that are not consumed yet, may be called from any thread. Loading tail first keeps
+        // the difference from wrapping, but both may move in between, so it is clamped to the capacity
+        std::size_t occupancy() const {
+            std::size_t consumed = tail.load(std::memory_order_acquire);
+            std::size_t published = head.load(std::memory_order_acquire);
+            return std::min(published - consumed, capacity);
+        }
+
+        // blocks the consumer had to replace with silence
+        std::size_t underruns() const {
+            return underrun_count.load(std::memory_order_relaxed);
+        }
+
+        // producer side
+        std::size_t write_available() const {
+            return capacity - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+        }
+
+        T* write_block(std::size_t offset = 0) {
+            return &storage[((head.load(std::memory_order_relaxed) + offset) % capacity) * bsize];
+        }
+
+        void commit_write(std::size_t count = 1) {
+            head.store(head.load(std::memory_order_relaxed) + count, std::memory_order_release);
+        }
+
+        // consumer side, returns nullptr if the ring is empty
+        const T* read_block() const {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            if (head.load(std::memory_order_acquire) == t) {
+                return nullptr;
+            }
+            return &storage[(t % capacity) * bsize];
+        }
+
+        void commit_read() {
+            tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        void note_underrun(std::size_t blocks = 1) {
+            underrun_count.fetch_add(blocks, std::memory_order_relaxed);
+        }
+
+        // number of blocks the producer should keep queued, the consumer lowers or raises it to trade latency for
+        // safety against underruns. Starts at the capacity.
+        std::size_t fill_target() const {
+            return target.load(std::memory_order_relaxed);
+        }
+
+        void set_fill_target(std::size_t blocks) {
+            target.store(blocks, std::memory_order_relaxed);
+        }
+
+    private:
+        const std::size_t capacity;
+        const std::size_t bsize;
+        aligned_ptr_t<T> storage;
+
+        // monotonic counters, kept on separate cache lines to avoid false sharing
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+        alignas(64) std::atomic<std::size_t> underrun_count{0};
+        std::atomic<std::size_t> target{capacity};
+};
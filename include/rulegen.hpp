@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "opencl.hpp"
+
+// layout of the rule tensor: m x m weights per neighbour (dx, dy), followed by one bias per level
+#define RIDX_OTHER(m, dx, dy, ltarget, lsource) ((m) * (m) * (((dx) + 1) + 3 * ((dy) + 1)) + (m) * (ltarget) + (lsource))
+#define RIDX_BASE(m, l) ((m) * (m) * 9 + (l))
+
+// number of nonzero neighbour weights (bias excluded)
+std::size_t countRuleTaps(const std::vector<float>& rules, std::size_t m);
+
+// OpenCL source of `automaton_specialized(state_in, state_out)`, to be run with NDRange(n, n). It computes all levels
+// of one cell and contains only the nonzero weights as literals, in the same order as the generic kernel sums them. With
+// `banded`, the state has a halo row above and below the NDRange instead of wrapping around (see BANDED in automaton.cl).
+// The source starts with state.cl, so the state format and layout are selected by the build options (see STATE_FORMAT and
+// STATE_PLANE). With `vectorized`, every work-item computes STATE_VEC cells along x of the planar layout and the kernel
+// is run with NDRange(n / STATE_VEC, n).
+std::string generateAutomatonSource(const std::vector<float>& rules, std::size_t m, bool banded = false, bool vectorized = false);
+
+class RuleSpecializer {
+    public:
+        RuleSpecializer(const cl::Context& context, const std::vector<cl::Device>& devices, std::size_t m, float dense_threshold, bool banded = false, bool vectorized = false, const std::string& options = "", const std::string& cache_dir = "");
+
+        // regenerates and rebuilds the kernel if the rules differ from the last call, returns true if they did
+        bool update(const std::vector<float>& rules);
+
+        // false if the rules are too dense for specialization to pay off, use the generic kernel then
+        bool specialized() const {
+            return is_specialized;
+        }
+
+        const cl::Kernel& kernel() const {
+            return specialized_kernel;
+        }
+
+        std::size_t taps() const {
+            return ntaps;
+        }
+
+    private:
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        std::size_t m;
+        float dense_threshold;
+        bool banded;
+        bool vectorized;
+        std::string options;
+        std::string cache_dir;
+
+        std::vector<float> current_rules;
+        std::size_t ntaps = 0;
+        bool is_specialized = false;
+        cl::Kernel specialized_kernel;
+};
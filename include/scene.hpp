@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+
+#include "common.hpp"
+
+// initial host data: the state, the rule tensor (see RIDX_OTHER / RIDX_BASE), one frequency and one RGBA color per level
+struct scene_t {
+    std::vector<float> state;
+    std::vector<float> rules;
+    std::vector<float> frequencies;
+    std::vector<float> colors;
+};
+
+// the built-in demo, a single seed that grows into three interacting levels, needs m >= 4
+scene_t make_demo_scene(std::size_t n, std::size_t m);
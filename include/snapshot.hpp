@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "common.hpp"
+#include "scene.hpp"
+
+// Snapshot files hold everything needed to resume a run: the state (n * n * m values, interleaved), the rules,
+// frequencies and colors of the scene, the number of generations computed so far and the time of the next sample. The
+// arrays follow a 64 byte header as native fp32 values, so the state of a mapped file is uploaded as it is.
+
+// writes to a temporary file next to `path` first and renames it, so a crash never leaves half a snapshot behind
+void writeSnapshot(const std::string& path, std::size_t n, std::size_t m, const float* state, const scene_t& scene, std::uint64_t generations, float t);
+
+// read-only mapping of a snapshot file, the header is checked against the file size on open
+class MappedSnapshot {
+    public:
+        explicit MappedSnapshot(const std::string& path);
+        ~MappedSnapshot();
+
+        MappedSnapshot(const MappedSnapshot&) = delete;
+        MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+        std::size_t n() const;
+        std::size_t m() const;
+        std::uint64_t generations() const;
+        float t() const;
+
+        // points into the mapping, the pages are read on first access
+        const float* state() const;
+
+        // copies of the rules, frequencies and colors, the state is left empty
+        scene_t scene() const;
+
+    private:
+        const unsigned char* data = nullptr;
+        std::size_t size = 0;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "config.hpp"
+#include "opencl.hpp"
+
+// The visualize and audio stages as run by the Pipeline (one automaton split into bands, one device each) and by the
+// Ensemble (many automata in the same launches, dimension 2 selects the instance): checks, kernel arguments and the
+// launches. The Pipeline passes one instance, and `first` and `cells` describe the rows of a band in its state buffer
+// including the halo rows, the Ensemble the whole grid of every instance.
+
+// samples per work-group of the reduction
+constexpr std::size_t reduce_local_samples = 4;
+
+// upper bound for the partial blocks (samples mode) or sums (levels mode) of one reduction, per instance
+constexpr std::size_t reduce_max_groups = 64;
+
+// checks the settings of the visualize and audio stages, throws MyException
+void checkStageConfig(const config_t& config);
+
+// checks the work-group size of the reduce (samples mode) or the amplitudes kernel (levels mode) against `device`
+void checkAudioWorkGroup(const cl::Kernel& kernel, const cl::Device& device, const config_t& config);
+
+// blocks rendered per chunk of `cells` cells
+std::size_t renderChunkBlocks(const config_t& config, std::size_t cells);
+
+// partial blocks (samples mode) or sums (levels mode) of the first reduction of `cells` cells
+std::size_t reduceGroups(const config_t& config, std::size_t cells);
+
+// the arguments that stay the same for every frame
+void setVisualizeArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dColors, const config_t& config, std::size_t first);
+void setRenderArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dFrequencies, const cl::Buffer& dBuffer0, const config_t& config, std::size_t first, std::size_t cells);
+void setAmplitudesArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dPartial, const config_t& config, std::size_t first, std::size_t cells);
+void setReduceArgs(cl::Kernel& kernel, const config_t& config);
+void setSynthesizeArgs(cl::Kernel& kernel, const cl::Buffer& dPartial, const cl::Buffer& dFrequencies, const config_t& config, std::size_t ngroups);
+
+// Every enqueue below waits for `wait` and leaves its last event in it, appends its events to `evts`, and those that
+// read the state to `readers` if not null.
+
+// renders `cells` cells from `first` on in chunks of render_chunk cells and folds every chunk into the same `ngroups`
+// partial blocks of dBuffer1. If `finish` is set and one pass suffices, it writes the samples, scaled by `norm`, to
+// dSamples directly and true is returned, otherwise enqueueReduceFinal has to follow
+bool enqueueRenderChunks(const cl::CommandQueue& queue, cl::Kernel& kernelRender, cl::Kernel& kernelReduce, const cl::Buffer& dBuffer0, const cl::Buffer& dBuffer1, const cl::Buffer& dSamples, const config_t& config, std::size_t first, std::size_t cells, std::size_t ngroups, std::size_t instances, float t, float norm, bool finish, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts_render, std::vector<cl::Event>& evts_reduce, std::vector<cl::Event>* readers);
+
+// combines `ngroups` partial blocks of dBuffer1 into the samples, scaled by `norm`
+void enqueueReduceFinal(const cl::CommandQueue& queue, cl::Kernel& kernelReduce, const cl::Buffer& dBuffer1, const cl::Buffer& dSamples, const config_t& config, std::size_t ngroups, std::size_t instances, float norm, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts);
+
+// sums the levels into `ngroups` partial sums
+void enqueueAmplitudes(const cl::CommandQueue& queue, cl::Kernel& kernel, const config_t& config, std::size_t ngroups, std::size_t instances, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts, std::vector<cl::Event>* readers);
+
+// synthesizes generations_per_launch blocks of samples from the partial sums
+void enqueueSynthesize(const cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& dSamples, const config_t& config, std::size_t instances, float t, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts);
+
+// the device time of all `evts` in ms
+float getEventsTimeMS(const std::vector<cl::Event>& evts);
+
+// Frames in flight in a fixed number of slots, submitted and retired in order. `T::evts_download` are the events that
+// complete a frame.
+template <typename T>
+class FrameRing {
+    public:
+        void resize(std::size_t slots) {
+            frames.resize(slots);
+        }
+
+        typename std::vector<T>::iterator begin() {
+            return frames.begin();
+        }
+
+        typename std::vector<T>::iterator end() {
+            return frames.end();
+        }
+
+        std::size_t submitted() const {
+            return nsubmitted;
+        }
+
+        std::size_t retired() const {
+            return nretired;
+        }
+
+        std::size_t in_flight() const {
+            return nsubmitted - nretired;
+        }
+
+        bool has_slot() const {
+            return in_flight() < frames.size();
+        }
+
+        // the oldest frame can be retired without waiting, or it has to be because every slot is taken
+        bool retire_ready() const {
+            if (in_flight() == 0) {
+                return false;
+            }
+            const std::vector<cl::Event>& evts = frames[nretired % frames.size()].evts_download;
+            return !has_slot() || std::all_of(evts.begin(), evts.end(), [](const cl::Event& evt) {
+                return evt.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+            });
+        }
+
+        // the slot of the next frame, counted as submitted by `push`
+        T& next() {
+            return frames[nsubmitted % frames.size()];
+        }
+
+        void push() {
+            ++nsubmitted;
+        }
+
+        T& newest() {
+            return frames[(nsubmitted - 1) % frames.size()];
+        }
+
+        // the slot of the oldest frame in flight, counted as retired by `pop`
+        T& oldest() {
+            return frames[nretired % frames.size()];
+        }
+
+        void pop() {
+            ++nretired;
+        }
+
+    private:
+        std::vector<T> frames;
+        std::size_t nsubmitted = 0;
+        std::size_t nretired = 0;
+};
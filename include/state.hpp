@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "config.hpp"
+
+// bytes per state value on the device
+std::size_t stateValueSize(state_format_t format);
+
+// build option that selects the format in state.cl
+std::string stateFormatOption(state_format_t format);
+
+// converts values to the device representation, rounding the same way the kernels do
+std::vector<unsigned char> encodeState(const std::vector<float>& values, state_format_t format);
+std::vector<float> decodeState(const std::vector<unsigned char>& data, state_format_t format);
+
+// build options that select the layout in state.cl for a buffer of `cells` cells, empty for the interleaved layout
+std::string stateLayoutOption(state_layout_t layout, std::size_t cells, std::size_t vector);
+
+// converts interleaved host values (level + cell * m) to the device layout and back
+std::vector<float> toStateLayout(const std::vector<float>& values, std::size_t m, state_layout_t layout);
+std::vector<float> fromStateLayout(const std::vector<float>& values, std::size_t m, state_layout_t layout);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "common.hpp"
+
+// Fixed set of worker threads for data-parallel loops. `run(count, task)` calls `task(i)` for every i in [0, count) and
+// returns when all calls are done, the calling thread takes part. Indices are taken one at a time from a shared
+// counter, so threads that finish early take over the remaining work of slower ones. Does not allocate per `run`.
+class ThreadPool {
+    public:
+        // `threads` includes the calling thread, 0 for one per hardware thread
+        explicit ThreadPool(std::size_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        std::size_t size() const {
+            return workers.size() + 1;
+        }
+
+        // rethrows the first exception thrown by a task, the other tasks still run
+        template <typename F>
+        void run(std::size_t count, F&& task) {
+            using task_t = typename std::remove_reference<F>::type;
+            dispatch(count, [](void* context, std::size_t i) { (*static_cast<task_t*>(context))(i); }, &task);
+        }
+
+    private:
+        using invoke_t = void (*)(void*, std::size_t);
+
+        void dispatch(std::size_t count, invoke_t invoke, void* context);
+        void loop();
+        void work();
+
+        std::mutex mutex;
+        std::condition_variable cv_start;
+        std::condition_variable cv_done;
+        std::size_t generation = 0; // incremented by every dispatch, wakes the workers
+        std::size_t busy = 0;       // workers that did not finish the current generation yet
+        bool stopping = false;
+        std::exception_ptr error;
+
+        invoke_t invoke = nullptr;
+        void* context = nullptr;
+        std::size_t count = 0;
+        std::atomic<std::size_t> next{0};
+
+        std::vector<std::thread> workers;
+};
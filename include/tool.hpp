@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "opencl.hpp"
+
+// Helpers of the headless tools (s2015bench, s2015offline, s2015ensemble), which take their own `--key=value` options
+// in front of the pipeline settings and write images without a GUI.
+
+// setters of the tool options, called with the value of `--key=value`
+using tool_options_t = std::map<std::string, std::function<void(const std::string&)>>;
+
+// applies the arguments that name one of `options` and collects all others (after argv[0]) in `rest` for parse_config.
+// With --help, the keys of `options` are listed under `name` before parse_config lists its own
+void split_tool_options(const std::string& name, const tool_options_t& options, int argc, char** argv, std::vector<char*>& rest);
+
+// the OpenCL platforms, empty if there is no ICD loader at all
+std::vector<cl::Platform> tool_platforms();
+
+// the devices of platform `platform` from index `device` on, throws MyException if either does not exist
+std::vector<cl::Device> tool_devices(const std::vector<cl::Platform>& platforms, std::size_t platform, std::size_t device);
+
+// writes `n` * `n` RGBA pixels as binary PPM, without alpha
+void write_ppm(const std::string& path, const unsigned char* rgba, std::size_t n);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "common.hpp"
+
+// Tracing of spans and counters from all threads into one Chrome/Perfetto trace (chrome://tracing, ui.perfetto.dev).
+// Every thread records into its own fixed-size buffer without locks, events past its capacity are dropped and counted.
+// Disabled until `traceEnable`, then every call costs a clock read and a buffer write. Timestamps are nanoseconds since
+// `traceEnable` on the steady clock. Names must be string literals or otherwise outlive the tracer.
+
+// starts recording with room for `capacity` events per thread, call once before the threads start
+void traceEnable(std::size_t capacity);
+bool traceEnabled();
+std::uint64_t traceNow();
+
+// names the calling thread in the trace
+void traceThreadName(const std::string& name);
+
+// an extra track that is not a thread, e.g. a device queue, events on it are recorded by the calling thread
+std::uint32_t traceTrack(const std::string& name);
+
+// `track` 0 is the calling thread
+void traceSpan(const char* name, std::uint64_t start, std::uint64_t end, std::uint32_t track = 0);
+void traceCounter(const char* name, double value);
+
+// writes everything recorded so far as Chrome trace JSON, safe while the other threads keep recording
+void traceDump(const std::string& path);
+
+// records the lifetime of the scope as a span of the calling thread
+class TraceScope {
+    public:
+        explicit TraceScope(const char* name) : name(name), start(traceEnabled() ? traceNow() : 0), active(traceEnabled()) {}
+
+        ~TraceScope() {
+            if (active) {
+                traceSpan(name, start, traceNow());
+            }
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+    private:
+        const char* name;
+        std::uint64_t start;
+        bool active;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer/single-consumer triple buffer. The producer owns the `back()` slot, the consumer the
+// `front()` slot, the third one is exchanged atomically: `publish()` swaps back and middle, `acquire()` swaps middle and
+// front if something new was published. Neither side ever waits, the consumer only sees the latest published value.
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() = default;
+
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+        // producer side
+        T& back() {
+            return slots[back_index];
+        }
+
+        void publish() {
+            back_index = static_cast<std::uint8_t>(middle.exchange(static_cast<std::uint8_t>(back_index | fresh), std::memory_order_acq_rel) & index_mask);
+        }
+
+        // consumer side, returns false if nothing was published since the last call
+        bool acquire() {
+            if (!(middle.load(std::memory_order_relaxed) & fresh)) {
+                return false;
+            }
+            front_index = static_cast<std::uint8_t>(middle.exchange(front_index, std::memory_order_acq_rel) & index_mask);
+            return true;
+        }
+
+        const T& front() const {
+            return slots[front_index];
+        }
+
+    private:
+        static constexpr std::uint8_t index_mask = 0x3;
+        static constexpr std::uint8_t fresh = 0x4;
+
+        T slots[3] = {};
+
+        // index of the middle slot plus the `fresh` flag, sides are kept on separate cache lines
+        alignas(64) std::atomic<std::uint8_t> middle{1};
+        alignas(64) std::uint8_t back_index = 0;
+        alignas(64) std::uint8_t front_index = 2;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+
+// Launch profiles: the work-group shapes of every stage, tuned on the device they run on. `tuneLaunchConfig` benchmarks
+// one parameter after the other, every candidate with the best values found so far, and only tries shapes within the
+// work-group size and local memory limits of the devices. Profiles are stored in `tuning_file`, one line per device,
+// driver, problem size and kernel variant, as `--key=value` options that get applied before the command line, so
+// explicit options still win. A profile whose shapes no longer fit is ignored with a warning.
+
+// identifies what a profile was tuned for: the device and every option that changes the kernels or their launch
+// constraints
+std::string tuningKey(const config_t& config, const std::vector<cl::Device>& devices);
+
+// the options stored for `key`, empty if there are none
+std::vector<std::string> loadTuningProfile(const std::string& path, const std::string& key);
+
+// replaces the profile stored for `key` and keeps all others, concurrent calls are serialized via `path`.lock
+void storeTuningProfile(const std::string& path, const std::string& key, const std::vector<std::string>& options);
+
+// `config` with the stored profile of `devices` applied, followed by the command line again
+config_t applyTuningProfile(const config_t& config, const std::vector<cl::Device>& devices, int argc, char** argv, const std::shared_ptr<spdlog::logger>& log);
+
+// runs `warmup` plus `frames` frames per candidate and returns the options of the fastest combination by median device
+// time per frame
+std::vector<std::string> tuneLaunchConfig(const config_t& config, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, std::size_t warmup, std::size_t frames);
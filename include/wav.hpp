@@ -0,0 +1,26 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+
+#include "common.hpp"
+
+// mono 32 bit float WAV file, the sizes in the header are filled in when the writer is destroyed
+class WavWriter {
+    public:
+        WavWriter(const std::string& path, std::size_t sample_rate);
+        ~WavWriter();
+
+        WavWriter(const WavWriter&) = delete;
+        WavWriter& operator=(const WavWriter&) = delete;
+
+        void write(const float* data, std::size_t count);
+
+    private:
+        void write_header();
+
+        std::string path;
+        std::ofstream file;
+        std::size_t sample_rate;
+        std::size_t data_bytes = 0;
+};
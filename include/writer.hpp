@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "common.hpp"
+
+// Runs file writes on a background thread in the order they were posted, so that the disk never holds up the device
+// directly. At most `capacity` bytes of task data wait in the queue, `post` blocks while it is full (a single larger
+// task is let through when the queue is empty).
+class BackgroundWriter {
+    public:
+        explicit BackgroundWriter(std::size_t capacity);
+        ~BackgroundWriter();
+
+        BackgroundWriter(const BackgroundWriter&) = delete;
+        BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+        // `bytes` is the size of the data owned by `task`, rethrows the error of an earlier task
+        void post(std::size_t bytes, std::function<void()> task);
+
+        // runs the remaining tasks and stops the thread, rethrows the first error
+        void finish();
+
+        // number of times `post` had to wait for the writer, read it after `finish`
+        std::size_t stalls() const {
+            return stall_count;
+        }
+
+    private:
+        void loop();
+
+        const std::size_t capacity;
+        std::mutex mutex;
+        std::condition_variable cv_tasks;
+        std::condition_variable cv_space;
+        std::deque<std::pair<std::size_t, std::function<void()>>> tasks;
+        std::size_t queued = 0;
+        bool stopping = false;
+        std::exception_ptr error;
+        std::size_t stall_count = 0;
+        std::thread thread;
+};
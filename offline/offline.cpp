@@ -0,0 +1,207 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "opencl.hpp"
+#include "pipeline.hpp"
+#include "scene.hpp"
+#include "snapshot.hpp"
+#include "tool.hpp"
+#include "tuning.hpp"
+#include "wav.hpp"
+#include "writer.hpp"
+
+
+// Offline renderer: runs the pipeline without GUI and sound server as fast as the devices allow and writes every audio
+// block to --audio-file (WAV, empty to skip) and every --image-every-th visualization frame to --image-dir (one PPM per
+// frame) and/or --image-stream (raw RGBA frames back to back, "-" for stdout). Nothing is dropped, so the output only
+// depends on the config. Options that are not handled here are passed on to parse_config:
+//
+//     s2015offline --seconds=60 --audio-file=out.wav --image-dir=frames --n=512
+//
+// Files are written by a background thread, at most --writer-buffer MiB wait for it before the pipeline is held up.
+// With --resume, the render continues from a snapshot, and --snapshot-file gets the state after the last frame.
+
+
+namespace {
+
+struct offline_config_t {
+    double seconds = 10.;
+    std::size_t generations = 0; // overrides seconds if set
+    std::string image_dir;
+    std::string image_stream;
+    std::size_t image_every = 1;
+    std::size_t writer_buffer = 256;
+    std::size_t platform = 0;
+    std::size_t device = 0;
+};
+
+// splits the arguments into offline options and the ones for parse_config
+offline_config_t parse_offline_config(int argc, char** argv, std::vector<char*>& rest) {
+    offline_config_t offline;
+    tool_options_t options = {
+        {"seconds", [&](const std::string& v) { offline.seconds = parse_double("seconds", v); }},
+        {"generations", [&](const std::string& v) { offline.generations = parse_size("generations", v); }},
+        {"image-dir", [&](const std::string& v) { offline.image_dir = v; }},
+        {"image-stream", [&](const std::string& v) { offline.image_stream = v; }},
+        {"image-every", [&](const std::string& v) { offline.image_every = parse_size("image-every", v); }},
+        {"writer-buffer", [&](const std::string& v) { offline.writer_buffer = parse_size("writer-buffer", v); }},
+        {"platform", [&](const std::string& v) { offline.platform = parse_size("platform", v); }},
+        {"device", [&](const std::string& v) { offline.device = parse_size("device", v); }}
+    };
+
+    split_tool_options("offline", options, argc, argv, rest);
+    myassert(offline.generations > 0 || offline.seconds > 0., "seconds or generations must be positive");
+    myassert(offline.image_every > 0, "image_every must be positive");
+    return offline;
+}
+
+void run(const config_t& config, const offline_config_t& offline, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, const MappedSnapshot* snapshot) {
+    std::size_t n = config.n;
+    std::size_t k = config.generations_per_launch;
+    std::size_t blocks = offline.generations > 0
+        ? offline.generations
+        : static_cast<std::size_t>(std::ceil(offline.seconds * static_cast<double>(config.sample_rate) / static_cast<double>(config.nsamples)));
+    std::size_t frames = (blocks + k - 1) / k;
+    if (blocks % k != 0) {
+        // the last launch computes whole frames, so its audio, images and state are all kept
+        blocks = frames * k;
+        log->info() << "round up to " << blocks << " generations, a multiple of generations_per_launch";
+    }
+    log->info() << "render " << blocks << " generations in " << frames << " frames";
+
+    scene_t scene = snapshot ? snapshot->scene() : make_demo_scene(n, config.m);
+
+    // the outputs are only touched by the writer thread once set up, which finishes before they are destroyed
+    std::shared_ptr<WavWriter> wav;
+    if (!config.audio_file.empty()) {
+        wav = std::make_shared<WavWriter>(config.audio_file, config.sample_rate);
+    }
+    if (!offline.image_dir.empty()) {
+        makeDirectories(offline.image_dir);
+    }
+    std::shared_ptr<std::ofstream> stream_file;
+    std::ostream* stream = nullptr;
+    if (offline.image_stream == "-") {
+        stream = &std::cout;
+    } else if (!offline.image_stream.empty()) {
+        stream_file = std::make_shared<std::ofstream>(offline.image_stream, std::ios::binary | std::ios::trunc);
+        myassert(stream_file->good(), "cannot open " + offline.image_stream);
+        stream = stream_file.get();
+    }
+    BackgroundWriter writer(offline.writer_buffer << 20);
+    std::size_t retired = 0;
+
+    // declared after everything its callbacks touch, so that it drains first if an exception unwinds the stack
+    auto hTexture = std::make_shared<TripleBuffer<texture_view_t>>();
+    auto audiobuffer = std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(config), config.nsamples);
+    std::unique_ptr<Backend> pipeline = makeBackend(config, context, devices, log, snapshot ? snapshot->state() : scene.state.data(), scene.rules, scene.frequencies, scene.colors, hTexture, audiobuffer);
+    if (snapshot) {
+        pipeline->set_clock(snapshot->generations(), snapshot->t());
+    }
+    // the snapshot at the end holds the state after the last frame that was written
+    pipeline->set_frame_limit(frames);
+
+    // every retired frame is the newest one in the triple buffer, so none gets lost
+    pipeline->set_stats_callback([&](const frame_stats_t&) {
+        std::size_t frame = retired++;
+        hTexture->acquire();
+        if (frame % offline.image_every != 0 || (offline.image_dir.empty() && !stream)) {
+            return;
+        }
+        const unsigned char* data = hTexture->front().data;
+        auto pixels = std::make_shared<std::vector<unsigned char>>(data, data + 4 * n * n);
+        std::string image_dir = offline.image_dir;
+        writer.post(pixels->size(), [pixels, frame, n, image_dir, stream]() {
+            if (!image_dir.empty()) {
+                char name[32];
+                std::snprintf(name, sizeof(name), "/%06zu.ppm", frame);
+                write_ppm(image_dir + name, pixels->data(), n);
+            }
+            if (stream) {
+                stream->write(reinterpret_cast<const char*>(pixels->data()), static_cast<std::streamsize>(pixels->size()));
+                myassert(stream->good(), "cannot write image stream");
+            }
+        });
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    while (retired < frames) {
+        if (!pipeline->poll()) {
+            std::this_thread::yield();
+        }
+        while (const float* block = audiobuffer->read_block()) {
+            if (wav) {
+                auto samples = std::make_shared<std::vector<float>>(block, block + config.nsamples);
+                writer.post(sizeof(float) * samples->size(), [wav, samples]() {
+                    wav->write(samples->data(), samples->size());
+                });
+            }
+            audiobuffer->commit_read();
+        }
+    }
+    pipeline->drain();
+    if (!config.snapshot_file.empty()) {
+        log->info() << "snapshot to " << config.snapshot_file;
+        pipeline->request_snapshot([&](state_snapshot_t s) {
+            std::vector<float> state = s.decode();
+            writeSnapshot(config.snapshot_file, n, config.m, state.data(), scene, s.generations, s.t);
+        });
+    }
+    double compute = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writer.finish();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double audio_seconds = static_cast<double>(blocks * config.nsamples) / static_cast<double>(config.sample_rate);
+    log->info() << "done after " << wall << "s (" << compute << "s compute), " << audio_seconds / wall << "x real time, writer stalled " << writer.stalls() << " times";
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    // stdout may carry the image stream
+    auto log = spdlog::stderr_logger_mt("offline");
+
+    try {
+        std::vector<char*> rest;
+        offline_config_t offline = parse_offline_config(argc, argv, rest);
+        config_t config = parse_config(static_cast<int>(rest.size()), rest.data());
+        std::unique_ptr<MappedSnapshot> snapshot;
+        if (!config.resume.empty()) {
+            snapshot.reset(new MappedSnapshot(config.resume));
+            log->info() << "resume " << config.resume << " after " << snapshot->generations() << " generations";
+            config.n = snapshot->n();
+            config.m = snapshot->m();
+        }
+
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        if (config.backend == backend_t::opencl) {
+            log->debug() << "get platform and device";
+            devices = Pipeline::select_devices(config, tool_devices(tool_platforms(), offline.platform, offline.device));
+            context = cl::Context(devices);
+            config = applyTuningProfile(config, devices, static_cast<int>(rest.size()), rest.data(), log);
+        }
+        myassert(!snapshot || (config.n == snapshot->n() && config.m == snapshot->m()), "--n and --m contradict the snapshot");
+
+        run(config, offline, context, devices, log, snapshot.get());
+    } catch (const cl::Error& e) {
+        log->error() << e.what() << " (" << e.err() << ")";
+        return EXIT_FAILURE;
+    } catch (const std::exception& e) {
+        log->error() << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
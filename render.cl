@@ -3,7 +3,13 @@ float freq_function(float t) {
     return (float)((converted % 2) * 2 - 1);
 }
 
-__kernel void render(__constant float* state, __constant float* frequencies, __global float* buffer, const uint m, const float t0, const uint nsamples, const uint rate, const uint reduction_size, __local float* samples) {
+// renders one block per `reduction_size` cells, starting at cell `cell_offset`. Cells at or behind `ncells` are skipped,
+// so the grid can be processed in chunks of any size. The blocks of every instance follow those of the one before.
+__kernel void render(__global const state_t* state, __constant float* frequencies, __global float* buffer, const uint m, const float t0, const uint nsamples, const uint rate, const uint reduction_size, const ulong cell_offset, const ulong ncells, __local float* samples) {
+    state += INSTANCE_STATE(get_global_id(2), m);
+    frequencies += get_global_id(2) * m;
+    buffer += get_global_id(2) * get_num_groups(0) * nsamples * get_local_size(1);
+
     const uint samples_base = get_local_id(1) * nsamples;
     for (uint sample = 0; sample < nsamples; ++sample) {
         samples[samples_base + sample] = 0.f;
@@ -11,23 +17,22 @@ __kernel void render(__constant float* state, __constant float* frequencies, __g
     // no barrier because distinct ranges
 
     const float time_factor = 1.f / (float)(rate);
-    uint base_state = get_global_id(0) * reduction_size * m;
-    for (uint e = 0; e < reduction_size; ++e) {
+    size_t cell = cell_offset + get_global_id(0) * reduction_size;
+    for (uint e = 0; e < reduction_size && cell + e < ncells; ++e) {
         for (uint f = 0; f < m; ++f) {
             const float freq = frequencies[f];
             if (freq > 0.f) {
                 for (uint sample = 0; sample < nsamples; ++sample) {
                     const float t = t0 + (float)(samples_base + sample) * time_factor;
-                    samples[samples_base + sample] += freq_function(t * freq) * state[base_state + f];
+                    samples[samples_base + sample] += freq_function(t * freq) * STATE_LOAD(state, STATE_IDX(cell + e, f, m));
                 }
             }
         }
-        base_state += m;
     }
     barrier(CLK_LOCAL_MEM_FENCE);
 
     // linear write-back, uses memory coalescing
-    const uint base_buffer = get_group_id(0) * nsamples * get_local_size(1) + get_local_id(1);
+    const size_t base_buffer = get_group_id(0) * nsamples * get_local_size(1) + get_local_id(1);
     const uint samples_end = nsamples * get_local_size(1);
     const float norm = 1.f / (float)(reduction_size);
     for (uint sample = 0; sample < samples_end; sample += get_local_size(1)) {
@@ -35,27 +40,149 @@ __kernel void render(__constant float* state, __constant float* frequencies, __g
     }
 }
 
-__kernel void reduce(__constant float* buffer_in, __global float* buffer_out, uint nsamples, uint reduction_size, __local float* samples) {
+#if defined(STATE_PLANE) && defined(STATE_VEC)
+float state_vsum(floatv v) {
+#if STATE_VEC == 8
+    float4 v4 = v.lo + v.hi;
+#else
+    float4 v4 = v;
+#endif
+    return (v4.s0 + v4.s1) + (v4.s2 + v4.s3);
+}
+
+// `render` for the planar layout: since the oscillators of a level are the same for all cells of a block, the values of
+// a level are summed with vector loads first and every sample is computed once per level instead of once per cell.
+// Same arguments and ranges as `render`, only the rounding differs.
+__kernel void render_planar(__global const state_t* state, __constant float* frequencies, __global float* buffer, const uint m, const float t0, const uint nsamples, const uint rate, const uint reduction_size, const ulong cell_offset, const ulong ncells, __local float* samples) {
     const uint samples_base = get_local_id(1) * nsamples;
     for (uint sample = 0; sample < nsamples; ++sample) {
         samples[samples_base + sample] = 0.f;
     }
-    barrier(CLK_LOCAL_MEM_FENCE);
+    // no barrier because distinct ranges
 
-    const uint samples_end = nsamples * get_local_size(1);
-    uint base_in = get_group_id(0) * nsamples * get_local_size(1) * reduction_size + get_local_id(1);
-    for (uint e = 0; e < reduction_size; ++e) {
-        for (uint sample = 0; sample < samples_end; sample += get_local_size(1)) {
-            samples[get_local_id(1) + sample] += buffer_in[base_in + sample];
+    const float time_factor = 1.f / (float)(rate);
+    size_t cell = cell_offset + get_global_id(0) * reduction_size;
+    size_t cells = cell < ncells ? min((size_t)reduction_size, (size_t)(ncells - cell)) : 0;
+    for (uint f = 0; f < m; ++f) {
+        const float freq = frequencies[f];
+        if (freq > 0.f) {
+            floatv values = 0.f;
+            size_t e = 0;
+            for (; e + STATE_VEC <= cells; e += STATE_VEC) {
+                values += STATE_VLOAD(state, STATE_IDX(cell + e, f, m));
+            }
+            float value = state_vsum(values);
+            for (; e < cells; ++e) {
+                value += STATE_LOAD(state, STATE_IDX(cell + e, f, m));
+            }
+            for (uint sample = 0; sample < nsamples; ++sample) {
+                const float t = t0 + (float)(samples_base + sample) * time_factor;
+                samples[samples_base + sample] += freq_function(t * freq) * value;
+            }
         }
-        base_in += samples_end;
     }
     barrier(CLK_LOCAL_MEM_FENCE);
 
     // linear write-back, uses memory coalescing
-    const uint base_buffer = get_group_id(0) * nsamples * get_local_size(1) + get_local_id(1);
+    const size_t base_buffer = get_group_id(0) * nsamples * get_local_size(1) + get_local_id(1);
+    const uint samples_end = nsamples * get_local_size(1);
     const float norm = 1.f / (float)(reduction_size);
     for (uint sample = 0; sample < samples_end; sample += get_local_size(1)) {
-        buffer_out[base_buffer + sample] = samples[get_local_id(1) + sample] * norm;
+        buffer[base_buffer + sample] = samples[get_local_id(1) + sample] * norm;
+    }
+}
+#endif
+
+// with `accumulate` set, the result is added to `buffer_out` instead of overwriting it
+__kernel void reduce(__global const float* buffer_in, __global float* buffer_out, const uint nsamples, const uint count, const float norm, const uint accumulate, __local float* lanes) {
+    // one set of blocks per instance
+    buffer_in += get_global_id(2) * count * nsamples;
+    buffer_out += get_global_id(2) * get_num_groups(1) * nsamples;
+
+    // dimension 0 walks the samples (coalesced reads), dimension 1 the blocks that get folded together
+    const uint sample = get_global_id(0);
+    const uint lane_idx = get_local_id(0) + get_local_id(1) * get_local_size(0);
+
+    // every lane folds a strided subset of all blocks
+    float sum = 0.f;
+    for (uint block = get_global_id(1); block < count; block += get_global_size(1)) {
+        sum += buffer_in[(size_t)block * nsamples + sample];
+    }
+    lanes[lane_idx] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // tree reduction over dimension 1, local size must be a power of 2
+    for (uint stride = get_local_size(1) / 2; stride > 0; stride /= 2) {
+        if (get_local_id(1) < stride) {
+            lanes[lane_idx] += lanes[lane_idx + stride * get_local_size(0)];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (get_local_id(1) == 0) {
+        const size_t idx = get_group_id(1) * nsamples + sample;
+        buffer_out[idx] = (accumulate ? buffer_out[idx] : 0.f) + lanes[get_local_id(0)] * norm;
+    }
+}
+
+// sums `ncells` cells starting at cell `cell_offset`
+__kernel void amplitudes(__global const state_t* state, __global float* partial, const uint m, const ulong ncells, __local float* lanes, const ulong cell_offset) {
+    state += INSTANCE_STATE(get_global_id(2), m);
+    partial += get_global_id(2) * get_num_groups(1) * m;
+
+    // dimension 0 walks the levels (coalesced reads), dimension 1 the cells that get folded together
+    const uint level = get_global_id(0);
+    const uint lane_idx = get_local_id(0) + get_local_id(1) * get_local_size(0);
+
+    // every lane folds a strided subset of all cells
+    float sum = 0.f;
+    for (size_t cell = get_global_id(1); cell < ncells; cell += get_global_size(1)) {
+        sum += STATE_LOAD(state, STATE_IDX(cell_offset + cell, level, m));
+    }
+    lanes[lane_idx] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // tree reduction over dimension 1, local size must be a power of 2
+    for (uint stride = get_local_size(1) / 2; stride > 0; stride /= 2) {
+        if (get_local_id(1) < stride) {
+            lanes[lane_idx] += lanes[lane_idx + stride * get_local_size(0)];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (get_local_id(1) == 0) {
+        partial[get_group_id(1) * m + level] = lanes[get_local_id(0)];
+    }
+}
+
+__kernel void synthesize(__global const float* partial, __constant float* frequencies, __global float* buffer, const uint m, const uint ngroups, const float t0, const uint rate, const float norm, __local float* amplitudes) {
+    // dimension 1 selects the generation, for automaton kernels that advance multiple generations per launch, and
+    // dimension 2 the instance
+    const uint block = get_global_id(1);
+    partial += (get_global_id(2) * get_global_size(1) + block) * ngroups * m;
+    frequencies += get_global_id(2) * m;
+    buffer += get_global_id(2) * get_global_size(0) * get_global_size(1);
+
+    // combine the per-group partial sums, every work-group does this on its own
+    for (uint level = get_local_id(0); level < m; level += get_local_size(0)) {
+        float sum = 0.f;
+        for (uint group = 0; group < ngroups; ++group) {
+            sum += partial[group * m + level];
+        }
+        amplitudes[level] = sum * norm;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // one oscillator per level instead of one per cell and level
+    const uint sample = block * get_global_size(0) + get_global_id(0);
+    const float time_factor = 1.f / (float)(rate);
+    const float t = t0 + (float)(sample) * time_factor;
+    float value = 0.f;
+    for (uint f = 0; f < m; ++f) {
+        const float freq = frequencies[f];
+        if (freq > 0.f) {
+            value += freq_function(t * freq) * amplitudes[f];
+        }
     }
+    buffer[sample] = value;
 }
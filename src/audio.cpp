@@ -1,118 +1,149 @@
+#include <algorithm>
 #include <chrono>
 #include <thread>
+#include <vector>
 
-#include <pulse/error.h>
-#include <pulse/simple.h>
-
-#include "common.hpp"
-
-class PulseWrapper {
-    public:
-        PulseWrapper(std::size_t samplerate) {
-            pa_sample_spec ss = {
-                .format = PA_SAMPLE_FLOAT32LE,
-                .rate = static_cast<std::uint32_t>(samplerate),
-                .channels = 1
-            };
-            int err;
-
-            s = pa_simple_new(
-                nullptr,
-                "s2015ocl",
-                PA_STREAM_PLAYBACK,
-                nullptr,
-                "playback",
-                &ss,
-                nullptr,
-                nullptr,
-                &err
-            );
-
-            if (!s) {
-                throw_exception(err, "unknown error (pa_simple_new)");
-            }
-        }
+#include "audio.hpp"
+#include "pulse.hpp"
+#include "trace.hpp"
 
-        ~PulseWrapper() {
-            pa_simple_free(s);
-        }
 
-        void write(const std::vector<float>& data) {
-            int err;
-            if (!data.empty()) {
-                if (pa_simple_write(s, data.data(), data.size(), &err) < 0) {
-                    throw_exception(err, "unknown error (pa_simple_write)");
-                }
-                something_played = true;
-            }
-        }
+AudioSink::AudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log, std::size_t queue_ms)
+    : sample_rate(config.sample_rate),
+      log(log),
+      audiobuffer(audiobuffer) {
+    std::size_t block_size = audiobuffer->block_size();
+    min_blocks = std::max<std::size_t>(1, (queue_ms * sample_rate / 1000 + block_size - 1) / block_size);
+    audiobuffer->set_fill_target(min_blocks);
+}
+
+audio_metrics_t AudioSink::metrics() const {
+    audio_metrics_t metrics;
+    std::size_t block_size = audiobuffer->block_size();
+    std::size_t queued = audiobuffer->occupancy() * block_size;
+    std::size_t offset = read_offset.load(std::memory_order_relaxed);
+    queued -= std::min(queued, offset);
+    double ms_per_sample = 1000. / static_cast<double>(sample_rate);
+    metrics.latency_ms = static_cast<double>(queued + backend_samples.load(std::memory_order_relaxed)) * ms_per_sample;
+    metrics.target_ms = static_cast<double>(audiobuffer->fill_target() * block_size) * ms_per_sample;
+    metrics.underruns = audiobuffer->underruns() + backend_underruns.load(std::memory_order_relaxed);
+    metrics.samples = played_samples.load(std::memory_order_relaxed);
+    return metrics;
+}
 
-        std::size_t latency() {
-            if (something_played) {
-                int err;
-                std::size_t l = pa_simple_get_latency(s, &err);
-                if (err != PA_OK) {
-                    // TODO: why is the pulse error handling so weird?!
-                    //throw_exception(err, "unknown error (pa_simple_get_latency)");
-                    return 0;
-                }
-                return l;
-            } else {
-                return 0;
+void AudioSink::pull(float* out, std::size_t count) {
+    TraceScope trace("pull");
+    std::size_t block_size = audiobuffer->block_size();
+    std::size_t remaining = count;
+    while (remaining > 0) {
+        const float* block = audiobuffer->read_block();
+        if (!block) {
+            std::fill(out, out + remaining, 0.f);
+            if (started) {
+                std::size_t counted = (gap_samples + block_size - 1) / block_size;
+                gap_samples += remaining;
+                audiobuffer->note_underrun((gap_samples + block_size - 1) / block_size - counted);
+                traceCounter("audio underruns", static_cast<double>(audiobuffer->underruns()));
+            }
+            if (started && !starved) {
+                std::size_t target = std::min(audiobuffer->blocks(), audiobuffer->fill_target() + std::max<std::size_t>(1, audiobuffer->fill_target() / 2));
+                audiobuffer->set_fill_target(target);
+                calm_samples = 0;
+                log->warn() << "audio queue does not contain content, queue " << target << " blocks from now on";
             }
+            starved = true;
+            break;
         }
+        started = true;
+        starved = false;
+        gap_samples = 0;
+
+        std::size_t offset = read_offset.load(std::memory_order_relaxed);
+        std::size_t n = std::min(remaining, block_size - offset);
+        std::copy(block + offset, block + offset + n, out);
+        out += n;
+        remaining -= n;
+        if (offset + n == block_size) {
+            audiobuffer->commit_read();
+            read_offset.store(0, std::memory_order_relaxed);
+        } else {
+            read_offset.store(offset + n, std::memory_order_relaxed);
+        }
+    }
+    played_samples.fetch_add(count, std::memory_order_relaxed);
+
+    // no underrun for a while, try a shorter queue again
+    calm_samples += count;
+    if (calm_samples >= 10 * sample_rate) {
+        calm_samples = 0;
+        if (audiobuffer->fill_target() > min_blocks) {
+            audiobuffer->set_fill_target(audiobuffer->fill_target() - 1);
+        }
+    }
+}
 
-    private:
-        pa_simple* s;
-        bool something_played = false;
+void AudioSink::set_backend_latency(std::size_t samples) {
+    backend_samples.store(samples, std::memory_order_relaxed);
+    traceCounter("audio backend latency ms", static_cast<double>(samples) * 1000. / static_cast<double>(sample_rate));
+}
 
-        void throw_exception(int err, const char* fallback_what) {
-            auto estring = pa_strerror(err);
-            if (estring) {
-                throw MyException(estring);
-            } else {
-                throw MyException(fallback_what);
-            }
+void AudioSink::note_backend_underrun() {
+    backend_underruns.fetch_add(1, std::memory_order_relaxed);
+    calm_samples = 0;
+}
+
+NullAudioSink::NullAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log)
+    : AudioSink(config, audiobuffer, log, config.audio_latency),
+      period(audiobuffer->block_size()) {}
+
+void NullAudioSink::run(const shared_atomic_t<bool>& shutdown) {
+    // the simulated card plays `period` samples whenever they are due
+    std::vector<float> block(period);
+    auto start = std::chrono::steady_clock::now();
+    std::size_t played = 0;
+    while (!(*shutdown)) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::size_t due = static_cast<std::size_t>(elapsed * static_cast<double>(sample_rate));
+        while (played + period <= due) {
+            pull(block.data(), period);
+            consume(block.data(), period);
+            played += period;
         }
-};
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+WavAudioSink::WavAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log)
+    : NullAudioSink(config, audiobuffer, log),
+      wav(config.audio_file, config.sample_rate) {}
 
-void main_audio(std::size_t samplerate, shared_mutex_t mGlobal, shared_atomic_t<bool> shutdown, shared_buffer_t<float> audiobuffer) {
-    auto log = spdlog::stdout_logger_mt("audio");
+void WavAudioSink::consume(const float* data, std::size_t count) {
+    wav.write(data, count);
+}
+
+std::unique_ptr<AudioSink> makeAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log) {
+    switch (config.audio_sink) {
+        case audio_sink_t::null:
+            log->info() << "discard audio";
+            return std::unique_ptr<AudioSink>(new NullAudioSink(config, audiobuffer, log));
+        case audio_sink_t::wav:
+            log->info() << "write audio to " << config.audio_file;
+            return std::unique_ptr<AudioSink>(new WavAudioSink(config, audiobuffer, log));
+        default:
+            log->info() << "connect to pulseaudio";
+            return std::unique_ptr<AudioSink>(new PulseAudioSink(config, audiobuffer, log));
+    }
+}
+
+void main_audio(std::shared_ptr<AudioSink> sink, std::shared_ptr<spdlog::logger> log, shared_atomic_t<bool> shutdown) {
     log->info() << "hello world";
+    traceThreadName("audio");
 
     try {
-        log->info() << "connect to pulseaudio";
-        PulseWrapper pulse(samplerate);
-        bool warned_about_underflow = true; // start with 'warned' state because of startup latency
-
-        while (!(*shutdown)) {
-            if (pulse.latency() < 1000000) {
-                std::vector<float> chunk;
-                {
-                    std::lock_guard<std::mutex> guard(*mGlobal);
-                    if (!audiobuffer->empty()) {
-                        chunk = audiobuffer->front();
-                        audiobuffer->pop();
-                    }
-                }
-
-                if (!chunk.empty()) {
-                    warned_about_underflow = false;
-                    log->debug() << "write to pulse";
-                    pulse.write(chunk);
-                } else {
-                    if (!warned_about_underflow) {
-                        log->warn() << "audio queue does not contain content";
-                        warned_about_underflow = true;
-                    }
-                }
-            } else {
-                log->debug() << "pulse latency high -> sleep";
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            }
-        }
+        sink->run(shutdown);
 
-        log->info() << "disconnect";
+        audio_metrics_t metrics = sink->metrics();
+        log->info() << "stop after " << metrics.samples << " samples, " << metrics.underruns << " underruns";
     } catch (const std::exception& e) {
         log->error() << e.what();
     } catch (...) {
@@ -0,0 +1,22 @@
+#include "backend.hpp"
+#include "cpu.hpp"
+#include "pipeline.hpp"
+
+
+std::unique_ptr<Backend> makeBackend(
+    const config_t& config,
+    const cl::Context& context,
+    const std::vector<cl::Device>& devices,
+    const std::shared_ptr<spdlog::logger>& log,
+    const float* hState,
+    const std::vector<float>& hRules,
+    const std::vector<float>& hFrequencies,
+    const std::vector<float>& hColors,
+    const shared_texture_t& hTexture,
+    const shared_buffer_t<float>& audiobuffer
+) {
+    if (config.backend == backend_t::cpu) {
+        return std::unique_ptr<Backend>(new CpuBackend(config, log, hState, hRules, hFrequencies, hColors, hTexture, audiobuffer));
+    }
+    return std::unique_ptr<Backend>(new Pipeline(config, context, devices, log, hState, hRules, hFrequencies, hColors, hTexture, audiobuffer));
+}
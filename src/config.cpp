@@ -0,0 +1,231 @@
+#include <cstdlib>
+
+#include <functional>
+#include <iostream>
+#include <map>
+
+#include "config.hpp"
+
+
+std::size_t parse_size(const std::string& key, const std::string& value) {
+    try {
+        std::size_t pos;
+        unsigned long long result = std::stoull(value, &pos);
+        if (pos == value.size()) {
+            return static_cast<std::size_t>(result);
+        }
+    } catch (const std::exception&) {
+        // handled below
+    }
+    throw MyException("invalid value for " + key + ": " + value);
+}
+
+float parse_float(const std::string& key, const std::string& value) {
+    try {
+        std::size_t pos;
+        float result = std::stof(value, &pos);
+        if (pos == value.size()) {
+            return result;
+        }
+    } catch (const std::exception&) {
+        // handled below
+    }
+    throw MyException("invalid value for " + key + ": " + value);
+}
+
+double parse_double(const std::string& key, const std::string& value) {
+    try {
+        std::size_t pos;
+        double result = std::stod(value, &pos);
+        if (pos == value.size()) {
+            return result;
+        }
+    } catch (const std::exception&) {
+        // handled below
+    }
+    throw MyException("invalid value for " + key + ": " + value);
+}
+
+
+namespace {
+
+template <typename T>
+T parse_enum(const std::string& key, const std::string& value, const std::map<std::string, T>& choices) {
+    auto it = choices.find(value);
+    if (it == choices.end()) {
+        std::string msg = "invalid value for " + key + ": " + value + " (choices:";
+        for (const auto& kv : choices) {
+            msg += " " + kv.first;
+        }
+        throw MyException(msg + ")");
+    }
+    return it->second;
+}
+
+// $XDG_CACHE_HOME/s2015ocl or ~/.cache/s2015ocl, no cache if neither variable is set
+std::string default_program_cache() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg && *xdg) {
+        return std::string(xdg) + "/s2015ocl";
+    }
+    const char* home = std::getenv("HOME");
+    if (home && *home) {
+        return std::string(home) + "/.cache/s2015ocl";
+    }
+    return "";
+}
+
+// $XDG_CONFIG_HOME/s2015ocl/tuning or ~/.config/s2015ocl/tuning, no profiles if neither variable is set
+std::string default_tuning_file() {
+    const char* xdg = std::getenv("XDG_CONFIG_HOME");
+    if (xdg && *xdg) {
+        return std::string(xdg) + "/s2015ocl/tuning";
+    }
+    const char* home = std::getenv("HOME");
+    if (home && *home) {
+        return std::string(home) + "/.config/s2015ocl/tuning";
+    }
+    return "";
+}
+
+typedef std::map<std::string, std::function<void(const std::string&)>> options_t;
+
+// setters for every key, bound to `config`
+options_t config_options(config_t& config) {
+    return {
+        {"n", [&](const std::string& v) { config.n = parse_size("n", v); }},
+        {"m", [&](const std::string& v) { config.m = parse_size("m", v); }},
+        {"reduction-size", [&](const std::string& v) { config.reduction_size = parse_size("reduction-size", v); }},
+        {"sample-rate", [&](const std::string& v) { config.sample_rate = parse_size("sample-rate", v); }},
+        {"nsamples", [&](const std::string& v) { config.nsamples = parse_size("nsamples", v); }},
+        {"render-mode", [&](const std::string& v) {
+            config.render_mode = parse_enum<render_mode_t>("render-mode", v, {
+                {"samples", render_mode_t::samples},
+                {"levels", render_mode_t::levels}
+            });
+        }},
+        {"render-chunk", [&](const std::string& v) { config.render_chunk = parse_size("render-chunk", v); }},
+        {"automaton-kernel", [&](const std::string& v) {
+            config.automaton_kernel = parse_enum<automaton_kernel_t>("automaton-kernel", v, {
+                {"generic", automaton_kernel_t::generic},
+                {"tiled", automaton_kernel_t::tiled},
+                {"specialized", automaton_kernel_t::specialized},
+                {"sparse", automaton_kernel_t::sparse},
+                {"fused", automaton_kernel_t::fused}
+            });
+        }},
+        {"automaton-tile", [&](const std::string& v) { config.automaton_tile = parse_size("automaton-tile", v); }},
+        {"local-width", [&](const std::string& v) { config.local_width = parse_size("local-width", v); }},
+        {"local-height", [&](const std::string& v) { config.local_height = parse_size("local-height", v); }},
+        {"render-group", [&](const std::string& v) { config.render_group = parse_size("render-group", v); }},
+        {"reduce-lanes", [&](const std::string& v) { config.reduce_lanes = parse_size("reduce-lanes", v); }},
+        {"generations-per-launch", [&](const std::string& v) { config.generations_per_launch = parse_size("generations-per-launch", v); }},
+        {"frames-in-flight", [&](const std::string& v) { config.frames_in_flight = parse_size("frames-in-flight", v); }},
+        {"queue-mode", [&](const std::string& v) {
+            config.queue_mode = parse_enum<queue_mode_t>("queue-mode", v, {
+                {"in-order", queue_mode_t::in_order},
+                {"out-of-order", queue_mode_t::out_of_order},
+                {"split", queue_mode_t::split}
+            });
+        }},
+        {"output-memory", [&](const std::string& v) {
+            config.output_memory = parse_enum<output_memory_t>("output-memory", v, {
+                {"copy", output_memory_t::copy},
+                {"alloc-host-ptr", output_memory_t::alloc_host_ptr},
+                {"use-host-ptr", output_memory_t::use_host_ptr}
+            });
+        }},
+        {"state-format", [&](const std::string& v) {
+            config.state_format = parse_enum<state_format_t>("state-format", v, {
+                {"fp32", state_format_t::fp32},
+                {"fp16", state_format_t::fp16},
+                {"unorm16", state_format_t::unorm16},
+                {"unorm8", state_format_t::unorm8}
+            });
+        }},
+        {"state-layout", [&](const std::string& v) {
+            config.state_layout = parse_enum<state_layout_t>("state-layout", v, {
+                {"interleaved", state_layout_t::interleaved},
+                {"planar", state_layout_t::planar}
+            });
+        }},
+        {"state-vector", [&](const std::string& v) { config.state_vector = parse_size("state-vector", v); }},
+        {"backend", [&](const std::string& v) {
+            config.backend = parse_enum<backend_t>("backend", v, {
+                {"opencl", backend_t::opencl},
+                {"cpu", backend_t::cpu}
+            });
+        }},
+        {"cpu-threads", [&](const std::string& v) { config.cpu_threads = parse_size("cpu-threads", v); }},
+        {"cpu-block-rows", [&](const std::string& v) { config.cpu_block_rows = parse_size("cpu-block-rows", v); }},
+        {"cpu-tile", [&](const std::string& v) { config.cpu_tile = parse_size("cpu-tile", v); }},
+        {"bands", [&](const std::string& v) { config.bands = parse_size("bands", v); }},
+        {"device-fission", [&](const std::string& v) {
+            config.device_fission = parse_enum<device_fission_t>("device-fission", v, {
+                {"none", device_fission_t::none},
+                {"numa", device_fission_t::numa},
+                {"equally", device_fission_t::equally}
+            });
+        }},
+        {"audio-sink", [&](const std::string& v) {
+            config.audio_sink = parse_enum<audio_sink_t>("audio-sink", v, {
+                {"pulse", audio_sink_t::pulse},
+                {"null", audio_sink_t::null},
+                {"wav", audio_sink_t::wav}
+            });
+        }},
+        {"audio-latency", [&](const std::string& v) { config.audio_latency = parse_size("audio-latency", v); }},
+        {"audio-file", [&](const std::string& v) { config.audio_file = v; }},
+        {"program-cache", [&](const std::string& v) { config.program_cache = v; }},
+        {"tuning-file", [&](const std::string& v) { config.tuning_file = v; }},
+        {"resume", [&](const std::string& v) { config.resume = v; }},
+        {"snapshot-file", [&](const std::string& v) { config.snapshot_file = v; }},
+        {"snapshot-interval", [&](const std::string& v) { config.snapshot_interval = parse_size("snapshot-interval", v); }},
+        {"profiling-interval", [&](const std::string& v) { config.profiling_interval = parse_size("profiling-interval", v); }},
+        {"trace-file", [&](const std::string& v) { config.trace_file = v; }},
+        {"trace-events", [&](const std::string& v) { config.trace_events = parse_size("trace-events", v); }},
+        {"rules-dense-threshold", [&](const std::string& v) { config.rules_dense_threshold = parse_float("rules-dense-threshold", v); }}
+    };
+}
+
+void apply_option(const options_t& options, const std::string& arg) {
+    auto eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+        throw MyException("arguments must have the form --key=value, got " + arg);
+    }
+    std::string key = arg.substr(2, eq - 2);
+    auto it = options.find(key);
+    if (it == options.end()) {
+        throw MyException("unknown option " + key);
+    }
+    it->second(arg.substr(eq + 1));
+}
+
+}
+
+
+config_t parse_config(int argc, char** argv) {
+    config_t config;
+    config.program_cache = default_program_cache();
+    config.tuning_file = default_tuning_file();
+    options_t options = config_options(config);
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--help") {
+            std::cout << "usage: " << argv[0] << " [--key=value]..." << std::endl << "keys:";
+            for (const auto& kv : options) {
+                std::cout << " " << kv.first;
+            }
+            std::cout << std::endl;
+            std::exit(EXIT_SUCCESS);
+        }
+        apply_option(options, arg);
+    }
+
+    return config;
+}
+
+void set_config_option(config_t& config, const std::string& arg) {
+    apply_option(config_options(config), arg);
+}
@@ -0,0 +1,412 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "cpu.hpp"
+#include "trace.hpp"
+
+
+namespace {
+
+// cells per vector, GCC/Clang vector extensions map this to the SIMD registers of the target (SSE or NEON by default,
+// AVX if enabled via the compiler flags). This file is built with -ffp-contract=off, otherwise FMA targets (AArch64,
+// -mfma) would fuse the multiply-adds below and round differently from the kernels.
+#ifdef __AVX__
+constexpr std::size_t vec = 8;
+#else
+constexpr std::size_t vec = 4;
+#endif
+typedef float floatv __attribute__((vector_size(vec * sizeof(float))));
+
+// levels that the automaton accumulates at once, every loaded vector is used for all of them
+constexpr std::size_t lanes = 8;
+
+floatv loadv(const float* p) {
+    floatv v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void storev(float* p, floatv v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// same as max(0.f, min(v, 1.f)) in the kernels
+floatv clampv(floatv v) {
+    floatv zero = {};
+    floatv one = zero + 1.f;
+    v = v < one ? v : one;
+    return v > zero ? v : zero;
+}
+
+float clamp(float v) {
+    return std::max(0.f, std::min(v, 1.f));
+}
+
+float freq_function(float t) {
+    int converted = static_cast<int>(t * 2.f);
+    return static_cast<float>((converted % 2) * 2 - 1);
+}
+
+}
+
+
+CpuBackend::CpuBackend(
+    const config_t& config,
+    const std::shared_ptr<spdlog::logger>& log,
+    const float* hState,
+    const std::vector<float>& hRules,
+    const std::vector<float>& hFrequencies,
+    const std::vector<float>& hColors,
+    const shared_texture_t& hTexture,
+    const shared_buffer_t<float>& audiobuffer
+) : config(config),
+    log(log),
+    hTexture(hTexture),
+    audiobuffer(audiobuffer),
+    n(config.n),
+    m(config.m),
+    stride(config.n + 2),
+    tile((config.cpu_tile + vec - 1) / vec * vec),
+    nblocks(config.cpu_block_rows > 0 ? (config.n + config.cpu_block_rows - 1) / config.cpu_block_rows : 0),
+    pool(config.cpu_threads),
+    rules(hRules),
+    frequencies(hFrequencies),
+    colors(hColors) {
+    std::size_t generations_per_launch = config.generations_per_launch;
+
+    // check config
+    myassert(n > 0 && m > 0, "n and m must be positive");
+    myassert(config.cpu_block_rows > 0, "cpu_block_rows must be positive");
+    myassert(tile > 0, "cpu_tile must be positive");
+    myassert(generations_per_launch > 0, "generations_per_launch must be positive");
+    myassert(config.bands == 1, "backend cpu requires bands 1");
+    myassert(config.state_format == state_format_t::fp32, "backend cpu requires state_format fp32");
+    myassert(hRules.size() == 9 * m * m + m, "rules do not match m");
+    myassert(hFrequencies.size() == m && hColors.size() == 4 * m, "frequencies or colors do not match m");
+    myassert(audiobuffer->block_size() == config.nsamples, "audiobuffer blocks must hold nsamples");
+    myassert(audiobuffer->blocks() >= generations_per_launch, "audiobuffer too small for generations_per_launch");
+    log->info() << "run natively on " << pool.size() << " threads, " << nblocks << " blocks of " << config.cpu_block_rows << " rows";
+
+    log->debug() << "convert state to planes";
+    for (auto& s : state) {
+        s = make_aligned<float>(m * n * stride, 64);
+    }
+    for (std::size_t level = 0; level < m; ++level) {
+        for (std::size_t y = 0; y < n; ++y) {
+            float* row = plane(0, level, y);
+            for (std::size_t x = 0; x < n; ++x) {
+                row[x] = hState[(y * n + x) * m + level];
+            }
+            row[-1] = row[n - 1];
+            row[n] = row[0];
+        }
+    }
+
+    partial.resize(generations_per_launch * nblocks * m);
+    amplitudes.resize(m);
+    textures.resize(3);
+    for (std::size_t i = 0; i < textures.size(); ++i) {
+        textures[i] = make_aligned<unsigned char>(4 * n * n);
+        textures_free.push_back(i);
+    }
+}
+
+bool CpuBackend::poll() {
+    if (!has_room() || (frame_limit > 0 && frames_published >= frame_limit)) {
+        return false;
+    }
+    launch();
+    return true;
+}
+
+void CpuBackend::drain() {
+    // every frame is retired by the launch that computed it
+}
+
+void CpuBackend::step() {
+    myassert(has_room(), "no room in the audiobuffer for another frame");
+    launch();
+}
+
+std::vector<float> CpuBackend::read_state() {
+    std::size_t parity = flipflop ? 1 : 0;
+    std::vector<float> result(n * n * m);
+    for (std::size_t level = 0; level < m; ++level) {
+        for (std::size_t y = 0; y < n; ++y) {
+            const float* row = plane(parity, level, y);
+            for (std::size_t x = 0; x < n; ++x) {
+                result[(y * n + x) * m + level] = row[x];
+            }
+        }
+    }
+    return result;
+}
+
+void CpuBackend::set_frame_limit(std::size_t frames) {
+    frame_limit = frames;
+}
+
+void CpuBackend::set_stats_callback(std::function<void(const frame_stats_t&)> callback) {
+    stats_callback = callback;
+}
+
+void CpuBackend::request_snapshot(std::function<void(state_snapshot_t)> callback) {
+    // frames are retired as soon as they are computed, so only the planes are copied here and interleaved later
+    std::size_t parity = flipflop ? 1 : 0;
+    auto planes = std::make_shared<std::vector<float>>(state[parity].get(), state[parity].get() + m * n * stride);
+    std::size_t n = this->n;
+    std::size_t m = this->m;
+    std::size_t stride = this->stride;
+    state_snapshot_t snapshot;
+    snapshot.generations = generations;
+    snapshot.t = t;
+    snapshot.bytes = sizeof(float) * planes->size();
+    snapshot.decode = [planes, n, m, stride]() {
+        std::vector<float> result(n * n * m);
+        for (std::size_t level = 0; level < m; ++level) {
+            for (std::size_t y = 0; y < n; ++y) {
+                const float* row = planes->data() + (level * n + y) * stride + 1;
+                for (std::size_t x = 0; x < n; ++x) {
+                    result[(y * n + x) * m + level] = row[x];
+                }
+            }
+        }
+        return result;
+    };
+    callback(std::move(snapshot));
+}
+
+void CpuBackend::set_clock(std::uint64_t generations, float t) {
+    this->generations = generations;
+    this->t = t;
+}
+
+bool CpuBackend::has_room() const {
+    // same limits as the Pipeline: at most half a second of audio queued and no more than the audio sink asks for
+    std::size_t k = config.generations_per_launch;
+    std::size_t blocks = audiobuffer->occupancy() + k;
+    return audiobuffer->write_available() >= k
+        && static_cast<float>((blocks - 1) * config.nsamples) < static_cast<float>(config.sample_rate) * 0.5f
+        && blocks <= std::max(audiobuffer->fill_target(), k);
+}
+
+void CpuBackend::launch() {
+    using clock = std::chrono::steady_clock;
+    auto elapsed = [](clock::time_point since) {
+        return std::chrono::duration<float, std::milli>(clock::now() - since).count();
+    };
+    std::size_t block_rows = config.cpu_block_rows;
+    frame_stats_t stats;
+    auto start = clock::now();
+
+    for (std::size_t generation = 0; generation < config.generations_per_launch; ++generation) {
+        TraceScope trace("automaton");
+        std::size_t parity = flipflop ? 1 : 0;
+        float* sums = partial.data() + generation * nblocks * m;
+        pool.run(nblocks, [&](std::size_t block) {
+            automaton_rows(parity, block * block_rows, std::min(n, (block + 1) * block_rows), sums + block * m);
+        });
+        flipflop = !flipflop;
+    }
+    stats.automaton = elapsed(start);
+
+    auto start_visualize = clock::now();
+    std::size_t slot = textures_free.back();
+    textures_free.pop_back();
+    {
+        TraceScope trace("visualize");
+        std::size_t parity = flipflop ? 1 : 0;
+        unsigned char* texture = textures[slot].get();
+        pool.run(nblocks, [&](std::size_t block) {
+            visualize_rows(parity, block * block_rows, std::min(n, (block + 1) * block_rows), texture);
+        });
+    }
+    stats.visualize = elapsed(start_visualize);
+
+    auto start_render = clock::now();
+    {
+        TraceScope trace("synthesize");
+        for (std::size_t generation = 0; generation < config.generations_per_launch; ++generation) {
+            synthesize(generation, audiobuffer->write_block(generation));
+        }
+    }
+    stats.render = elapsed(start_render);
+
+    HOT_DEBUG(log, "publish visualization");
+    texture_view_t& view = hTexture->back();
+    view.data = textures[slot].get();
+    view.version = ++frames_published;
+    view.slot = slot;
+    hTexture->publish();
+    // the back slot is owned by us again, its texture is neither displayed nor pending
+    texture_view_t& released = hTexture->back();
+    if (released.data) {
+        textures_free.push_back(released.slot);
+        released.data = nullptr;
+    }
+    audiobuffer->commit_write(config.generations_per_launch);
+    t += static_cast<float>(config.generations_per_launch * config.nsamples) / static_cast<float>(config.sample_rate);
+    generations += config.generations_per_launch;
+
+    stats.host = elapsed(start);
+    if (stats_callback) {
+        stats_callback(stats);
+    }
+}
+
+float* CpuBackend::plane(std::size_t parity, std::size_t level, std::size_t row) const {
+    // skips the left padding column
+    return state[parity].get() + (level * n + row) * stride + 1;
+}
+
+void CpuBackend::automaton_rows(std::size_t parity, std::size_t y0, std::size_t y1, float* sums) const {
+    const float* bias = rules.data() + 9 * m * m;
+    std::size_t level_stride = n * stride;
+
+    for (std::size_t x0 = 0; x0 < n; x0 += tile) {
+        std::size_t x1 = std::min(n, x0 + tile);
+        for (std::size_t y = y0; y < y1; ++y) {
+            // level 0 of the rows above, at and below y, wrapping around
+            const float* rows_in[3] = {plane(parity, 0, (y + n - 1) % n), plane(parity, 0, y), plane(parity, 0, (y + 1) % n)};
+            for (std::size_t level0 = 0; level0 < m; level0 += lanes) {
+                std::size_t nlevels = std::min(lanes, m - level0);
+                std::size_t x = x0;
+                for (; x + vec <= x1; x += vec) {
+                    floatv sum[lanes];
+                    for (std::size_t l = 0; l < nlevels; ++l) {
+                        sum[l] = floatv{} + bias[level0 + l];
+                    }
+                    for (std::size_t rules_x = 0; rules_x < 3; ++rules_x) {
+                        for (std::size_t rules_y = 0; rules_y < 3; ++rules_y) {
+                            const float* row = rows_in[rules_y] + x + rules_x - 1;
+                            const float* r = rules.data() + (rules_x + 3 * rules_y) * m * m + level0 * m;
+                            for (std::size_t dlevel = 0; dlevel < m; ++dlevel) {
+                                floatv values = loadv(row + dlevel * level_stride);
+                                for (std::size_t l = 0; l < nlevels; ++l) {
+                                    sum[l] += values * r[dlevel + l * m];
+                                }
+                            }
+                        }
+                    }
+                    for (std::size_t l = 0; l < nlevels; ++l) {
+                        storev(plane(1 - parity, level0 + l, y) + x, clampv(sum[l]));
+                    }
+                }
+                // the cells behind the last whole vector
+                for (; x < x1; ++x) {
+                    float sum[lanes];
+                    for (std::size_t l = 0; l < nlevels; ++l) {
+                        sum[l] = bias[level0 + l];
+                    }
+                    for (std::size_t rules_x = 0; rules_x < 3; ++rules_x) {
+                        for (std::size_t rules_y = 0; rules_y < 3; ++rules_y) {
+                            const float* row = rows_in[rules_y] + x + rules_x - 1;
+                            const float* r = rules.data() + (rules_x + 3 * rules_y) * m * m + level0 * m;
+                            for (std::size_t dlevel = 0; dlevel < m; ++dlevel) {
+                                float value = row[dlevel * level_stride];
+                                for (std::size_t l = 0; l < nlevels; ++l) {
+                                    sum[l] += value * r[dlevel + l * m];
+                                }
+                            }
+                        }
+                    }
+                    for (std::size_t l = 0; l < nlevels; ++l) {
+                        plane(1 - parity, level0 + l, y)[x] = clamp(sum[l]);
+                    }
+                }
+            }
+        }
+    }
+
+    // the padding columns of the new rows and their per-level sums for the audio
+    for (std::size_t level = 0; level < m; ++level) {
+        floatv sumv = {};
+        float sum = 0.f;
+        for (std::size_t y = y0; y < y1; ++y) {
+            float* row = plane(1 - parity, level, y);
+            row[-1] = row[n - 1];
+            row[n] = row[0];
+            std::size_t x = 0;
+            for (; x + vec <= n; x += vec) {
+                sumv += loadv(row + x);
+            }
+            for (; x < n; ++x) {
+                sum += row[x];
+            }
+        }
+        for (std::size_t i = 0; i < vec; ++i) {
+            sum += sumv[i];
+        }
+        sums[level] = sum;
+    }
+}
+
+void CpuBackend::visualize_rows(std::size_t parity, std::size_t y0, std::size_t y1, unsigned char* texture) const {
+    float fm = static_cast<float>(m);
+    for (std::size_t y = y0; y < y1; ++y) {
+        unsigned char* pixels = texture + 4 * y * n;
+        std::size_t x = 0;
+        for (; x + vec <= n; x += vec) {
+            floatv red = {};
+            floatv green = {};
+            floatv blue = {};
+            for (std::size_t level = 0; level < m; ++level) {
+                floatv values = loadv(plane(parity, level, y) + x);
+                red += values * colors[4 * level];
+                green += values * colors[4 * level + 1];
+                blue += values * colors[4 * level + 2];
+            }
+            red = clampv(red / fm) * 255.f;
+            green = clampv(green / fm) * 255.f;
+            blue = clampv(blue / fm) * 255.f;
+            for (std::size_t i = 0; i < vec; ++i) {
+                unsigned char* pixel = pixels + 4 * (x + i);
+                pixel[0] = static_cast<unsigned char>(red[i]);
+                pixel[1] = static_cast<unsigned char>(green[i]);
+                pixel[2] = static_cast<unsigned char>(blue[i]);
+                pixel[3] = 255;
+            }
+        }
+        for (; x < n; ++x) {
+            float channels[3] = {0.f, 0.f, 0.f};
+            for (std::size_t level = 0; level < m; ++level) {
+                float value = plane(parity, level, y)[x];
+                for (std::size_t c = 0; c < 3; ++c) {
+                    channels[c] += value * colors[4 * level + c];
+                }
+            }
+            unsigned char* pixel = pixels + 4 * x;
+            for (std::size_t c = 0; c < 3; ++c) {
+                pixel[c] = static_cast<unsigned char>(clamp(channels[c] / fm) * 255.f);
+            }
+            pixel[3] = 255;
+        }
+    }
+}
+
+void CpuBackend::synthesize(std::size_t generation, float* out) {
+    // combine the per-block sums in a fixed order, so the result does not depend on the thread schedule
+    const float* sums = partial.data() + generation * nblocks * m;
+    float norm = 1.f / static_cast<float>(n * n);
+    for (std::size_t level = 0; level < m; ++level) {
+        float sum = 0.f;
+        for (std::size_t block = 0; block < nblocks; ++block) {
+            sum += sums[block * m + level];
+        }
+        amplitudes[level] = sum * norm;
+    }
+
+    // one oscillator per level, timed like the synthesize kernel
+    float time_factor = 1.f / static_cast<float>(config.sample_rate);
+    for (std::size_t i = 0; i < config.nsamples; ++i) {
+        float time = t + static_cast<float>(generation * config.nsamples + i) * time_factor;
+        float value = 0.f;
+        for (std::size_t f = 0; f < m; ++f) {
+            if (frequencies[f] > 0.f) {
+                value += freq_function(time * frequencies[f]) * amplitudes[f];
+            }
+        }
+        out[i] = value;
+    }
+}
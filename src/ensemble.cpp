@@ -0,0 +1,259 @@
+#include "ensemble.hpp"
+#include "state.hpp"
+
+
+Ensemble::Ensemble(
+    const config_t& config,
+    const cl::Context& context,
+    const cl::Device& device,
+    const std::shared_ptr<spdlog::logger>& log,
+    const std::vector<scene_t>& scenes,
+    bool textures
+) : config(config),
+    log(log),
+    ninstances(scenes.size()),
+    with_textures(textures) {
+    std::size_t n = config.n;
+    std::size_t m = config.m;
+    std::size_t cells = n * n;
+    std::size_t nsamples = config.nsamples;
+    std::size_t rules_size = 9 * m * m + m;
+
+    // check config
+    myassert(ninstances > 0, "an ensemble needs at least one scene");
+    checkStageConfig(config);
+    myassert(config.local_width == 0 || (n % config.local_width == 0 && n % config.local_height == 0), "n must be a multiple of local_width and local_height");
+    myassert(config.bands == 1, "ensembles run on a single device, bands must be 1");
+    myassert(config.generations_per_launch == 1, "ensembles require generations_per_launch 1");
+    for (const auto& scene : scenes) {
+        myassert(scene.state.size() == cells * m && scene.rules.size() == rules_size && scene.frequencies.size() == m && scene.colors.size() == 4 * m, "every scene of an ensemble must match n and m");
+    }
+    // the rules of all instances are one __constant argument
+    std::size_t constant_size = static_cast<std::size_t>(device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>());
+    myassert(sizeof(cl_float) * ninstances * rules_size <= constant_size, "the rules of " + std::to_string(ninstances) + " instances exceed the constant memory of the device");
+    if (config.automaton_kernel != automaton_kernel_t::generic) {
+        log->info() << "ensembles always run the generic automaton kernel";
+    }
+
+    log->debug() << "build program";
+    std::vector<cl::Device> devices = {device};
+    std::string options = stateFormatOption(config.state_format) + stateLayoutOption(config.state_layout, cells, 1);
+    options += " -DINSTANCES=" + std::to_string(ninstances) + " -DINSTANCE_CELLS=" + std::to_string(cells);
+    cl::Program programAutomaton = buildProgramFromEmbedded({"state.cl", "automaton.cl"}, context, devices, options, config.program_cache);
+    cl::Program programVisualize = buildProgramFromEmbedded({"state.cl", "visualize.cl"}, context, devices, options, config.program_cache);
+    cl::Program programRender = buildProgramFromEmbedded({"state.cl", "render.cl"}, context, devices, options, config.program_cache);
+    for (std::size_t parity = 0; parity < 2; ++parity) {
+        kernelAutomaton[parity] = cl::Kernel(programAutomaton, "automaton");
+        kernelVisualize[parity] = cl::Kernel(programVisualize, "visualize");
+        kernelRender[parity] = cl::Kernel(programRender, "render");
+        kernelAmplitudes[parity] = cl::Kernel(programRender, "amplitudes");
+    }
+    kernelReduce = cl::Kernel(programRender, "reduce");
+    kernelSynthesize = cl::Kernel(programRender, "synthesize");
+    automatonLocal = config.local_width > 0 ? cl::NDRange(config.local_width, config.local_height, 1) : cl::NullRange;
+    visualizeLocal = automatonLocal;
+    checkAudioWorkGroup(config.render_mode == render_mode_t::samples ? kernelReduce : kernelAmplitudes[0], device, config);
+    ngroups = reduceGroups(config, cells);
+
+    log->debug() << "allocate buffers";
+    // the instances one after the other, the host data is only read here
+    std::vector<unsigned char> hState;
+    std::vector<float> hRules;
+    std::vector<float> hFrequencies;
+    for (const auto& scene : scenes) {
+        std::vector<unsigned char> encoded = encodeState(toStateLayout(scene.state, m, config.state_layout), config.state_format);
+        hState.insert(hState.end(), encoded.begin(), encoded.end());
+        hRules.insert(hRules.end(), scene.rules.begin(), scene.rules.end());
+        hFrequencies.insert(hFrequencies.end(), scene.frequencies.begin(), scene.frequencies.end());
+    }
+    dState0 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, hState.size(), hState.data());
+    dState1 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, hState.size(), hState.data());
+    dRules = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * hRules.size(), hRules.data());
+    dFrequencies = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * hFrequencies.size(), hFrequencies.data());
+    dColors = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * 4 * m, const_cast<float*>(scenes.front().colors.data()));
+    if (config.render_mode == render_mode_t::samples) {
+        dBuffer0 = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * ninstances * renderChunkBlocks(config, cells) * nsamples);
+        dBuffer1 = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * ninstances * ngroups * nsamples);
+    } else {
+        dPartial = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * ninstances * ngroups * m);
+    }
+    frames.resize(config.frames_in_flight);
+    for (auto& frame : frames) {
+        frame.samples.resize(ninstances * nsamples);
+        frame.dSamples = cl::Buffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float) * frame.samples.size());
+        if (with_textures) {
+            frame.textures.resize(sizeof(cl_uchar4) * ninstances * cells);
+            frame.dTextures = cl::Buffer(context, CL_MEM_WRITE_ONLY, frame.textures.size());
+        }
+    }
+
+    log->debug() << "set kernel args";
+    for (std::size_t parity = 0; parity < 2; ++parity) {
+        // odd frames read dState0 and write dState1, even frames the other way around
+        const cl::Buffer& dStateIn = parity ? dState0 : dState1;
+        const cl::Buffer& dStateOut = parity ? dState1 : dState0;
+        kernelAutomaton[parity].setArg(0, dStateIn);
+        kernelAutomaton[parity].setArg(1, dStateOut);
+        kernelAutomaton[parity].setArg(2, dRules);
+        setVisualizeArgs(kernelVisualize[parity], dStateOut, dColors, config, 0);
+        setRenderArgs(kernelRender[parity], dStateOut, dFrequencies, dBuffer0, config, 0, cells);
+        setAmplitudesArgs(kernelAmplitudes[parity], dStateOut, dPartial, config, 0, cells);
+    }
+    setReduceArgs(kernelReduce, config);
+    setSynthesizeArgs(kernelSynthesize, dPartial, dFrequencies, config, ngroups);
+
+    log->debug() << "create command queues";
+    queueCompute = cl::CommandQueue(context, device, cl::QueueProperties::Profiling);
+    queueTransfer = cl::CommandQueue(context, device, cl::QueueProperties::Profiling);
+
+    log->info() << "run " << ninstances << " instances of " << n << "x" << n << "x" << m << " per launch on " << device.getInfo<CL_DEVICE_NAME>();
+}
+
+Ensemble::~Ensemble() {
+    // the downloads write into the host vectors of their frames
+    try {
+        while (frames.in_flight() > 0) {
+            cl::Event::waitForEvents(frames.oldest().evts_download);
+            frames.pop();
+        }
+    } catch (const std::exception& e) {
+        log->warn() << "could not wait for the ensemble downloads: " << e.what();
+    }
+}
+
+bool Ensemble::poll(std::size_t limit) {
+    bool progress = false;
+
+    // retire in order, only block if every frame slot is taken
+    while (frames.retire_ready()) {
+        retire();
+        progress = true;
+    }
+
+    if (frames.submitted() < limit && frames.has_slot()) {
+        submit();
+        progress = true;
+    }
+
+    return progress;
+}
+
+void Ensemble::drain() {
+    while (frames.in_flight() > 0) {
+        retire();
+    }
+}
+
+std::vector<std::vector<float>> Ensemble::read_states() {
+    drain();
+    std::size_t instance_size = stateValueSize(config.state_format) * config.n * config.n * config.m;
+    std::vector<unsigned char> data(instance_size * ninstances);
+    // the state the next frame starts from
+    queueTransfer.enqueueReadBuffer(flipflop ? dState0 : dState1, true, 0, data.size(), data.data());
+
+    std::vector<std::vector<float>> states;
+    for (std::size_t i = 0; i < ninstances; ++i) {
+        auto first = data.begin() + static_cast<std::ptrdiff_t>(i * instance_size);
+        std::vector<unsigned char> instance(first, first + static_cast<std::ptrdiff_t>(instance_size));
+        states.push_back(fromStateLayout(decodeState(instance, config.state_format), config.m, config.state_layout));
+    }
+    return states;
+}
+
+void Ensemble::set_frame_callback(std::function<void(const ensemble_frame_t&)> callback) {
+    frame_callback = callback;
+}
+
+void Ensemble::set_clock(std::uint64_t generations, float t) {
+    myassert(frames.submitted() == 0, "the clock can only be set before the first frame");
+    this->generations = generations;
+    this->t = t;
+}
+
+void Ensemble::submit() {
+    std::size_t n = config.n;
+    std::size_t m = config.m;
+    std::size_t cells = n * n;
+    std::size_t nsamples = config.nsamples;
+    frame_t& frame = frames.next();
+    frame.submitted = std::chrono::steady_clock::now();
+    frame.generation = generations + 1;
+    frame.t = t;
+
+    // the compute queue is in order, so the stages of consecutive frames need no events between them
+    std::size_t parity = flipflop ? 1 : 0;
+    frame.evts_automaton.clear();
+    frame.evts_visualize.clear();
+    frame.evts_render.clear();
+    frame.evts_reduce.clear();
+    frame.evts_download.clear();
+
+    HOT_DEBUG(log, "run automaton kernel");
+    frame.evts_automaton.push_back(cl::Event());
+    queueCompute.enqueueNDRangeKernel(kernelAutomaton[parity], cl::NullRange, cl::NDRange(n, n, m * ninstances), automatonLocal, nullptr, &frame.evts_automaton.back());
+
+    if (with_textures) {
+        HOT_DEBUG(log, "run visualization kernel");
+        kernelVisualize[parity].setArg(1, frame.dTextures);
+        frame.evts_visualize.push_back(cl::Event());
+        queueCompute.enqueueNDRangeKernel(kernelVisualize[parity], cl::NullRange, cl::NDRange(n, n, ninstances), visualizeLocal, nullptr, &frame.evts_visualize.back());
+    }
+
+    // the stages share the launches of the Pipeline, the queue orders them so they start without a wait list
+    wait_audio.clear();
+    if (config.render_mode == render_mode_t::samples) {
+        float norm = static_cast<float>(config.reduction_size) / static_cast<float>(cells);
+        HOT_DEBUG(log, "run render and reduction kernels");
+        bool direct = enqueueRenderChunks(queueCompute, kernelRender[parity], kernelReduce, dBuffer0, dBuffer1, frame.dSamples, config, 0, cells, ngroups, ninstances, t, norm, true, wait_audio, frame.evts_render, frame.evts_reduce, nullptr);
+        if (!direct) {
+            HOT_DEBUG(log, "run final reduction kernel");
+            enqueueReduceFinal(queueCompute, kernelReduce, dBuffer1, frame.dSamples, config, ngroups, ninstances, norm, wait_audio, frame.evts_reduce);
+        }
+    } else {
+        HOT_DEBUG(log, "run amplitudes kernel");
+        enqueueAmplitudes(queueCompute, kernelAmplitudes[parity], config, ngroups, ninstances, wait_audio, frame.evts_render, nullptr);
+
+        HOT_DEBUG(log, "run synthesize kernel");
+        enqueueSynthesize(queueCompute, kernelSynthesize, frame.dSamples, config, ninstances, t, wait_audio, frame.evts_reduce);
+    }
+    queueCompute.flush();
+
+    HOT_DEBUG(log, "download visualization and rendered audio data");
+    wait_download = {frame.evts_reduce.back()};
+    frame.evts_download.push_back(cl::Event());
+    queueTransfer.enqueueReadBuffer(frame.dSamples, false, 0, sizeof(cl_float) * frame.samples.size(), frame.samples.data(), &wait_download, &frame.evts_download.back());
+    if (with_textures) {
+        wait_download = {frame.evts_visualize.back()};
+        frame.evts_download.push_back(cl::Event());
+        queueTransfer.enqueueReadBuffer(frame.dTextures, false, 0, frame.textures.size(), frame.textures.data(), &wait_download, &frame.evts_download.back());
+    }
+    queueTransfer.flush();
+
+    frames.push();
+    flipflop = !flipflop;
+    t += static_cast<float>(nsamples) / static_cast<float>(config.sample_rate);
+    ++generations;
+}
+
+void Ensemble::retire() {
+    frame_t& frame = frames.oldest();
+
+    HOT_DEBUG(log, "wait for downloads");
+    cl::Event::waitForEvents(frame.evts_download);
+    frames.pop();
+
+    if (frame_callback) {
+        ensemble_frame_t result;
+        result.generation = frame.generation;
+        result.t = frame.t;
+        result.samples = frame.samples.data();
+        result.textures = with_textures ? frame.textures.data() : nullptr;
+        result.stats.automaton = getEventsTimeMS(frame.evts_automaton);
+        result.stats.visualize = getEventsTimeMS(frame.evts_visualize);
+        result.stats.render = getEventsTimeMS(frame.evts_render);
+        result.stats.reduce = getEventsTimeMS(frame.evts_reduce);
+        result.stats.download = getEventsTimeMS(frame.evts_download);
+        result.stats.host = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frame.submitted).count();
+        frame_callback(result);
+    }
+}
@@ -7,6 +7,7 @@
 
 #include "common.hpp"
 #include "gui.hpp"
+#include "trace.hpp"
 
 
 class MyScreen : public nanogui::Screen {
@@ -15,16 +16,14 @@ class MyScreen : public nanogui::Screen {
             const std::shared_ptr<spdlog::logger>& logger,
             std::size_t n,
             std::size_t m,
-            const shared_mutex_t& mGlobal,
-            const shared_mem_t<unsigned char>& hTexture,
+            const shared_texture_t& hTexture,
             const shared_atomic_t<bool>& shutdown
         ) : Screen(Eigen::Vector2i(800, 600), "s2015ocl"),
             log(logger),
             n(n),
             m(m),
-            mGlobal(mGlobal),
             hTexture(hTexture),
-            shutdown(shutdown){
+            shutdown(shutdown) {
             mainwindow = new nanogui::Window(this, "s2015ocl");
             mainwindow->setPosition(Eigen::Vector2i(100, 100));
             mainwindow->setLayout(new nanogui::GroupLayout());
@@ -35,26 +34,36 @@ class MyScreen : public nanogui::Screen {
             visualization->setPolicy(nanogui::ImageView::SizePolicy::Expand);
             visualization->setFixedSize(Eigen::Vector2i(300, 300));
 
+            // one persistent image, blank until the first frame is published
+            std::vector<unsigned char> blank(n * n * 4, 0);
+            visualization->setImage(nvgCreateImageRGBA(
+                this->nvgContext(),
+                static_cast<int>(n),
+                static_cast<int>(n),
+                0,
+                blank.data()
+            ));
+            myassert(visualization->image() != 0, "image data should be loaded by nanovg");
+
             performLayout();
         }
 
-        virtual void drawAll() override {
-            log->debug() << "draw screen";
+        virtual ~MyScreen() {
+            nvgDeleteImage(this->nvgContext(), visualization->image());
+        }
 
-            // update visualization
-            if (visualization->image() != 0) {
-                nvgDeleteImage(this->nvgContext(), visualization->image());
-            }
-            {
-                std::lock_guard<std::mutex> guard(*mGlobal);
-                visualization->setImage(nvgCreateImageRGBA(
-                    this->nvgContext(),
-                    static_cast<int>(n),
-                    static_cast<int>(n),
-                    0,
-                    hTexture->data()
-                ));
-                myassert(visualization->image() != 0, "image data should be loaded by nanovg");
+        virtual void drawAll() override {
+            HOT_DEBUG(log, "draw screen");
+            TraceScope trace("draw");
+
+            // update visualization, only if the compute loop published a new generation
+            if (hTexture->acquire()) {
+                const texture_view_t& view = hTexture->front();
+                if (view.data && view.version != uploaded_version) {
+                    TraceScope trace_upload("upload");
+                    nvgUpdateImage(this->nvgContext(), visualization->image(), view.data);
+                    uploaded_version = view.version;
+                }
             }
 
             Screen::drawAll();
@@ -68,25 +77,28 @@ class MyScreen : public nanogui::Screen {
         std::shared_ptr<spdlog::logger> log;
         std::size_t n;
         std::size_t m;
-        shared_mutex_t mGlobal;
-        shared_mem_t<unsigned char> hTexture;
+        shared_texture_t hTexture;
         shared_atomic_t<bool> shutdown;
 
+        // version of the frame that is currently in the image
+        std::size_t uploaded_version = 0;
+
         // widgets, ref-counted by nanogui
         nanogui::Window* mainwindow;
         nanogui::ImageView* visualization;
 };
 
-void main_gui(std::size_t n, std::size_t m, shared_mutex_t mGlobal, shared_mem_t<unsigned char> hTexture, shared_atomic_t<bool> shutdown) {
+void main_gui(std::size_t n, std::size_t m, shared_texture_t hTexture, shared_atomic_t<bool> shutdown) {
     auto log_gui = spdlog::stdout_logger_mt("gui");
     log_gui->info() << "hello world";
+    traceThreadName("gui");
 
     log_gui->info() << "set up";
     nanogui::init();
 
     // inner part, where nanogui (and glfw) are initialized
     try {
-        MyScreen screen(log_gui, n, m, mGlobal, hTexture, shutdown);
+        MyScreen screen(log_gui, n, m, hTexture, shutdown);
         screen.drawAll();
         screen.setVisible(true);
 
@@ -0,0 +1,177 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "kernels.hpp"
+#include "opencl.hpp"
+
+
+namespace {
+
+// 64 bit FNV-1a, good enough to tell sources apart, the full key is checked on load anyway
+std::uint64_t fnv1a(const std::string& data) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (char c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string toHex(std::uint64_t value) {
+    std::ostringstream ss;
+    ss << std::hex << value;
+    return ss.str();
+}
+
+// everything a program binary depends on, stored in the cache file and compared on load
+std::string cacheKey(const cl::Device& device, const std::string& options, const std::string& sourceCode) {
+    return device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>() + '\0' + options + '\0' + toHex(fnv1a(sourceCode));
+}
+
+std::string cacheFile(const std::string& cacheDir, const std::string& key) {
+    return cacheDir + "/" + toHex(fnv1a(key)) + ".bin";
+}
+
+// file layout: magic, key length, key, binary length, binary
+const char cacheMagic[8] = {'s', '2', '0', '1', '5', 'b', 'i', 'n'};
+
+bool loadBinary(const std::string& fname, const std::string& key, std::vector<unsigned char>& binary) {
+    std::ifstream file(fname.c_str(), std::ios::binary);
+    char magic[sizeof(cacheMagic)];
+    std::uint64_t keySize;
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), cacheMagic) || !file.read(reinterpret_cast<char*>(&keySize), sizeof(keySize)) || keySize != key.size()) {
+        return false;
+    }
+    std::string storedKey(key.size(), '\0');
+    std::uint64_t binarySize;
+    if (!file.read(&storedKey[0], static_cast<std::streamsize>(key.size())) || storedKey != key || !file.read(reinterpret_cast<char*>(&binarySize), sizeof(binarySize))) {
+        return false;
+    }
+    binary.resize(static_cast<std::size_t>(binarySize));
+    return binarySize > 0 && file.read(reinterpret_cast<char*>(binary.data()), static_cast<std::streamsize>(binarySize));
+}
+
+void storeBinary(const std::string& fname, const std::string& key, const std::vector<unsigned char>& binary) {
+    // write to a temporary file first, so concurrent starts never see half-written entries
+    std::string tmp = tempPath(fname);
+    {
+        std::ofstream file(tmp.c_str(), std::ios::binary);
+        std::uint64_t keySize = key.size();
+        std::uint64_t binarySize = binary.size();
+        file.write(cacheMagic, sizeof(cacheMagic));
+        file.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+        file.write(key.data(), static_cast<std::streamsize>(key.size()));
+        file.write(reinterpret_cast<const char*>(&binarySize), sizeof(binarySize));
+        file.write(reinterpret_cast<const char*>(binary.data()), static_cast<std::streamsize>(binary.size()));
+        if (!file) {
+            std::remove(tmp.c_str());
+            return;
+        }
+    }
+    std::rename(tmp.c_str(), fname.c_str());
+}
+
+cl::Program buildUncached(const std::string& sourceCode, const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options) {
+    cl::Program program(context, sourceCode);
+    try {
+        program.build(devices, options.c_str());
+    } catch (const cl::Error& e) {
+        std::cout << "Build erros:" << std::endl;
+        for (const auto& dev : devices) {
+            std::string buildLog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(dev);
+            if (!buildLog.empty()) {
+                std::cout << buildLog << std::endl;
+            }
+        }
+        throw;
+    }
+    return program;
+}
+
+}
+
+
+void makeDirectories(const std::string& path) {
+    for (std::size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string prefix = path.substr(0, pos);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw MyException("cannot create directory " + prefix);
+        }
+        if (pos == std::string::npos) {
+            break;
+        }
+    }
+}
+
+std::string tempPath(const std::string& path) {
+    static std::atomic<unsigned> counter(0);
+    return path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
+cl::Program buildProgramFromSource(const std::string& sourceCode, const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options, const std::string& cacheDir) {
+    if (cacheDir.empty()) {
+        return buildUncached(sourceCode, context, devices, options);
+    }
+
+    // a hit requires a matching entry for every device
+    cl::Program::Binaries binaries(devices.size());
+    bool hit = true;
+    for (std::size_t i = 0; i < devices.size() && hit; ++i) {
+        std::string key = cacheKey(devices[i], options, sourceCode);
+        hit = loadBinary(cacheFile(cacheDir, key), key, binaries[i]);
+    }
+    if (hit) {
+        try {
+            cl::Program program(context, devices, binaries);
+            program.build(devices, options.c_str());
+            return program;
+        } catch (const cl::Error&) {
+            // rejected by the driver, rebuild from source and overwrite the entry
+        }
+    }
+
+    cl::Program program = buildUncached(sourceCode, context, devices, options);
+    try {
+        makeDirectories(cacheDir);
+        std::vector<cl::Device> programDevices = program.getInfo<CL_PROGRAM_DEVICES>();
+        cl::Program::Binaries built = program.getInfo<CL_PROGRAM_BINARIES>();
+        for (std::size_t i = 0; i < programDevices.size() && i < built.size(); ++i) {
+            if (!built[i].empty()) {
+                std::string key = cacheKey(programDevices[i], options, sourceCode);
+                storeBinary(cacheFile(cacheDir, key), key, built[i]);
+            }
+        }
+    } catch (const std::exception&) {
+        // the cache is an optimization only
+    }
+    return program;
+}
+
+cl::Program buildProgramFromEmbedded(const std::vector<std::string>& names, const cl::Context& context, const std::vector<cl::Device>& devices, const std::string& options, const std::string& cacheDir) {
+    const auto& sources = embeddedKernelSources();
+    std::string sourceCode;
+    for (const auto& name : names) {
+        auto it = sources.find(name);
+        if (it == sources.end()) {
+            throw MyException("no embedded kernel source " + name);
+        }
+        sourceCode += it->second + "\n";
+    }
+    return buildProgramFromSource(sourceCode, context, devices, options, cacheDir);
+}
+
+float getEventTimeMS(const cl::Event& evt) {
+    evt.wait();
+    cl_ulong t_start = evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong t_end = evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return static_cast<float>(t_end - t_start) / (1000.f * 1000.f);
+}
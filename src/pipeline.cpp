@@ -0,0 +1,891 @@
+#include <algorithm>
+
+#include "pipeline.hpp"
+#include "state.hpp"
+#include "trace.hpp"
+
+
+Pipeline::Pipeline(
+    const config_t& config,
+    const cl::Context& context,
+    const std::vector<cl::Device>& devices,
+    const std::shared_ptr<spdlog::logger>& log,
+    const float* hState,
+    const std::vector<float>& hRules,
+    const std::vector<float>& hFrequencies,
+    const std::vector<float>& hColors,
+    const shared_texture_t& hTexture,
+    const shared_buffer_t<float>& audiobuffer
+) : config(config),
+    devices(devices),
+    log(log),
+    hTexture(hTexture),
+    audiobuffer(audiobuffer),
+    zero_copy(config.output_memory != output_memory_t::copy),
+    halo_rows(config.bands > 1 ? 1 : 0),
+    vector_cells(config.state_layout == state_layout_t::planar ? config.state_vector : 1),
+    specializer(context, devices, config.m, config.rules_dense_threshold, config.bands > 1, vector_cells > 1, stateFormatOption(config.state_format) + stateLayoutOption(config.state_layout, config.n * config.n, vector_cells), config.program_cache) {
+    std::size_t n = config.n;
+    std::size_t m = config.m;
+    std::size_t nbands = config.bands;
+    std::size_t automaton_tile = config.automaton_tile;
+    std::size_t generations_per_launch = config.generations_per_launch;
+    automaton_kernel_t automaton_kernel = config.automaton_kernel;
+    bool temporal = generations_per_launch > 1;
+
+    // check config
+    checkStageConfig(config);
+    myassert((automaton_kernel != automaton_kernel_t::tiled && automaton_kernel != automaton_kernel_t::sparse && automaton_kernel != automaton_kernel_t::fused) || (automaton_tile > 0 && n % automaton_tile == 0), "n must be a multiple of automaton_tile");
+    myassert(generations_per_launch > 0, "generations_per_launch must be positive");
+    myassert(!temporal || config.render_mode == render_mode_t::levels, "generations_per_launch > 1 requires render_mode levels");
+    myassert(!temporal || (is_power_of_2(automaton_tile) && n % automaton_tile == 0), "generations_per_launch > 1 requires n to be a multiple of automaton_tile, which must be a power of 2");
+    myassert(audiobuffer->block_size() == config.nsamples, "audiobuffer blocks must hold nsamples");
+    myassert(audiobuffer->blocks() >= config.frames_in_flight * generations_per_launch, "audiobuffer too small for frames_in_flight");
+    myassert(nbands > 0 && devices.size() >= nbands, "bands must be positive, with one device per band");
+    myassert(nbands == 1 || !temporal, "bands > 1 requires generations_per_launch 1");
+    myassert(nbands == 1 || !zero_copy, "bands > 1 requires output_memory copy");
+    myassert(nbands == 1 || config.state_layout == state_layout_t::interleaved, "bands > 1 requires state_layout interleaved");
+    myassert(vector_cells == 1 || vector_cells == 4 || vector_cells == 8, "state_vector must be 1, 4 or 8");
+    myassert(n % vector_cells == 0, "n must be a multiple of state_vector");
+    myassert(config.local_width == 0 || (n / vector_cells) % config.local_width == 0, "n / state_vector must be a multiple of local_width");
+    sparse = !temporal && automaton_kernel == automaton_kernel_t::sparse;
+    myassert(nbands == 1 || !sparse, "bands > 1 requires a dense automaton_kernel");
+    fused = !temporal && automaton_kernel == automaton_kernel_t::fused;
+    myassert(!fused || config.render_mode == render_mode_t::levels, "automaton_kernel fused requires render_mode levels");
+    myassert(!fused || is_power_of_2(automaton_tile), "automaton_kernel fused requires automaton_tile to be a power of 2");
+
+    // tiled kernels need whole tiles in every band, the last band gets the fewest
+    std::vector<std::size_t> rows = band_rows(config);
+    myassert(rows.back() > 0, "not enough rows for bands");
+
+    log->debug() << "build program";
+    std::string stateOptions = stateFormatOption(config.state_format) + stateLayoutOption(config.state_layout, n * n, vector_cells);
+    std::string automatonOptions = stateOptions + " -DTILED_M=" + std::to_string(m) + " -DTILED_TILE=" + std::to_string(automaton_tile);
+    if (temporal) {
+        automatonOptions += " -DTEMPORAL_STEPS=" + std::to_string(generations_per_launch);
+    }
+    if (nbands > 1) {
+        automatonOptions += " -DBANDED";
+    }
+    programAutomaton = buildProgramFromEmbedded({"state.cl", "automaton.cl"}, context, devices, automatonOptions, config.program_cache);
+    cl::Program programVisualize = buildProgramFromEmbedded({"state.cl", "visualize.cl"}, context, devices, stateOptions, config.program_cache);
+    cl::Program programRender = buildProgramFromEmbedded({"state.cl", "render.cl"}, context, devices, stateOptions, config.program_cache);
+    if (config.state_format != state_format_t::fp32) {
+        log->info() << "store the state with " << stateValueSize(config.state_format) << " bytes per value";
+    }
+    if (config.state_layout == state_layout_t::planar) {
+        log->info() << "store one plane per level, " << vector_cells << " cells per work-item";
+    }
+    if (temporal) {
+        log->info() << "advance " << generations_per_launch << " generations per automaton launch";
+    } else if (fused) {
+        log->info() << "visualize and sum the levels in the automaton kernel";
+    } else if (automaton_kernel == automaton_kernel_t::specialized) {
+        specializer.update(hRules);
+    }
+    visualizeLocal = config.local_width > 0 ? cl::NDRange(config.local_width, config.local_height) : cl::NullRange;
+
+    log->debug() << "split grid into " << nbands << " bands";
+    bands.resize(nbands);
+    std::size_t y0 = 0;
+    for (std::size_t b = 0; b < nbands; ++b) {
+        band_t& band = bands[b];
+        band.y0 = y0;
+        band.rows = rows[b];
+        y0 += band.rows;
+        myassert(config.local_height == 0 || band.rows % config.local_height == 0, "the rows of every band must be a multiple of local_height");
+
+        // the bands and parities set different arguments, so every one needs its own kernel objects
+        for (std::size_t parity = 0; parity < 2; ++parity) {
+            band.kernelVisualize[parity] = cl::Kernel(programVisualize, vector_cells > 1 ? "visualize_planar" : "visualize");
+            band.kernelRender[parity] = cl::Kernel(programRender, vector_cells > 1 ? "render_planar" : "render");
+            band.kernelAmplitudes[parity] = cl::Kernel(programRender, "amplitudes");
+        }
+        band.kernelReduce = cl::Kernel(programRender, "reduce");
+        if (config.render_mode == render_mode_t::samples) {
+            checkAudioWorkGroup(band.kernelReduce, devices[b], config);
+        } else if (!temporal && !fused) {
+            checkAudioWorkGroup(band.kernelAmplitudes[0], devices[b], config);
+        }
+
+        // the temporal and the fused automaton kernel write one sum per tile
+        if (temporal) {
+            band.ngroups = (n / automaton_tile) * (n / automaton_tile);
+        } else if (fused) {
+            band.ngroups = (n / automaton_tile) * (band.rows / automaton_tile);
+        } else {
+            band.ngroups = reduceGroups(config, n * band.rows);
+        }
+        band.group_offset = ngroups;
+        ngroups += band.ngroups;
+    }
+    kernelSynthesize = cl::Kernel(programRender, "synthesize");
+    if (sparse) {
+        log->info() << "only compute tiles whose neighbourhood changed";
+        for (auto& kernel : kernelActivate) {
+            kernel = cl::Kernel(programAutomaton, "activate_tiles");
+        }
+    }
+
+    log->debug() << "allocate buffers";
+    // the host data is only read here, copies are owned by the devices
+    dRules = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * hRules.size(), const_cast<float*>(hRules.data()));
+    dFrequencies = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * hFrequencies.size(), const_cast<float*>(hFrequencies.data()));
+    dColors = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(cl_float) * hColors.size(), const_cast<float*>(hColors.data()));
+    if (config.render_mode == render_mode_t::samples) {
+        dBuffer1 = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * ngroups * config.nsamples);
+    } else {
+        dPartial = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * generations_per_launch * ngroups * m);
+    }
+    if (sparse) {
+        // every tile counts as changed before the first launch, which applies the biases to the empty regions
+        std::vector<cl_uint> hChanged((n / automaton_tile) * (n / automaton_tile), 1);
+        dTiles = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * hChanged.size());
+        dTileCount = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+        for (auto& dChangedFlags : dChanged) {
+            dChangedFlags = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(cl_uint) * hChanged.size(), hChanged.data());
+        }
+    }
+    for (std::size_t b = 0; b < nbands; ++b) {
+        band_t& band = bands[b];
+
+        if (nbands == 1 && config.state_format == state_format_t::fp32 && config.state_layout == state_layout_t::interleaved) {
+            // the host state is the device representation already, e.g. a mapped snapshot, so it is uploaded as it is
+            std::size_t size = sizeof(cl_float) * n * n * m;
+            band.dState0 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, size, const_cast<float*>(hState));
+            band.dState1 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, size, const_cast<float*>(hState));
+        } else {
+            // the rows of the band plus its halo rows, wrapped around the grid
+            std::vector<float> bandState;
+            bandState.reserve((band.rows + 2 * halo_rows) * n * m);
+            for (std::size_t row = 0; row < band.rows + 2 * halo_rows; ++row) {
+                const float* src = hState + ((band.y0 + n + row - halo_rows) % n) * n * m;
+                bandState.insert(bandState.end(), src, src + n * m);
+            }
+            std::vector<unsigned char> encoded = encodeState(toStateLayout(bandState, m, config.state_layout), config.state_format);
+            band.dState0 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, encoded.size(), encoded.data());
+            band.dState1 = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, encoded.size(), encoded.data());
+        }
+        if (nbands > 1) {
+            band.hEdges = make_aligned<unsigned char>(2 * stateValueSize(config.state_format) * n * m);
+        }
+
+        // the first band writes to the combined buffers directly, the others get gathered there
+        if (config.render_mode == render_mode_t::samples) {
+            // one chunk of blocks at a time, independent of n
+            band.dBuffer0 = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * renderChunkBlocks(config, n * band.rows) * config.nsamples);
+            band.dBuffer1 = b == 0 ? dBuffer1 : cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * band.ngroups * config.nsamples);
+        } else {
+            band.dPartial = b == 0 ? dPartial : cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * band.ngroups * m);
+        }
+    }
+    // one texture per frame in flight plus the displayed and the pending one
+    std::size_t texture_size = sizeof(cl_uchar4) * n * n;
+    textures.resize(config.frames_in_flight + 2);
+    for (std::size_t i = 0; i < textures.size(); ++i) {
+        texture_t& texture = textures[i];
+        if (config.output_memory == output_memory_t::use_host_ptr) {
+            texture.host = make_aligned<unsigned char>(texture_size);
+            texture.dTextures = {cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, texture_size, texture.host.get())};
+        } else if (config.output_memory == output_memory_t::alloc_host_ptr) {
+            texture.dTextures = {cl::Buffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, texture_size)};
+        } else {
+            texture.host = make_aligned<unsigned char>(texture_size);
+            for (const auto& band : bands) {
+                texture.dTextures.push_back(cl::Buffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uchar4) * n * band.rows));
+            }
+        }
+        textures_free.push_back(i);
+    }
+
+    // the audio ring itself becomes the output buffer, split into one sub-buffer per frame
+    std::size_t chunk_size = sizeof(cl_float) * generations_per_launch * config.nsamples;
+    std::size_t chunk_align = static_cast<std::size_t>(devices[0].getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>()) / 8;
+    if (zero_copy && audiobuffer->blocks() % generations_per_launch == 0 && chunk_size % chunk_align == 0) {
+        dAudioRing = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, sizeof(cl_float) * audiobuffer->blocks() * config.nsamples, audiobuffer->data());
+        audio_chunks.resize(audiobuffer->blocks() / generations_per_launch);
+        for (std::size_t i = 0; i < audio_chunks.size(); ++i) {
+            cl_buffer_region region = {i * chunk_size, chunk_size};
+            audio_chunks[i].dSamples = dAudioRing.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+        }
+    } else if (zero_copy) {
+        log->warn() << "audio blocks do not match the device alignment, download audio by copy";
+    }
+
+    frames.resize(config.frames_in_flight);
+    if (audio_chunks.empty()) {
+        for (auto& frame : frames) {
+            frame.dSamples = cl::Buffer(context, CL_MEM_READ_WRITE, chunk_size);
+        }
+    }
+
+    log->debug() << "set kernel args";
+    make_automaton_kernels();
+    for (auto& band : bands) {
+        for (std::size_t parity = 0; parity < 2; ++parity) {
+            const cl::Buffer& dStateOut = parity ? band.dState1 : band.dState0;
+            setVisualizeArgs(band.kernelVisualize[parity], dStateOut, dColors, config, halo_rows * n);
+            setRenderArgs(band.kernelRender[parity], dStateOut, dFrequencies, band.dBuffer0, config, halo_rows * n, band.rows * n);
+            setAmplitudesArgs(band.kernelAmplitudes[parity], dStateOut, band.dPartial, config, halo_rows * n, band.rows * n);
+        }
+        setReduceArgs(band.kernelReduce, config);
+    }
+    setSynthesizeArgs(kernelSynthesize, dPartial, dFrequencies, config, ngroups);
+    if (sparse) {
+        for (std::size_t parity = 0; parity < 2; ++parity) {
+            // reads the flags of the last launch and clears the ones this launch sets
+            kernelActivate[parity].setArg(0, dChanged[1 - parity]);
+            kernelActivate[parity].setArg(1, dChanged[parity]);
+            kernelActivate[parity].setArg(2, dTiles);
+            kernelActivate[parity].setArg(3, dTileCount);
+        }
+    }
+
+    log->debug() << "create command queues";
+    for (std::size_t b = 0; b < nbands; ++b) {
+        band_t& band = bands[b];
+        if (config.queue_mode == queue_mode_t::out_of_order) {
+            try {
+                band.queueCompute = cl::CommandQueue(context, devices[b], cl::QueueProperties::Profiling | cl::QueueProperties::OutOfOrder);
+            } catch (const cl::Error& e) {
+                log->warn() << "device does not support out-of-order queues, fall back to in-order";
+                band.queueCompute = cl::CommandQueue(context, devices[b], cl::QueueProperties::Profiling);
+            }
+        } else {
+            band.queueCompute = cl::CommandQueue(context, devices[b], cl::QueueProperties::Profiling);
+        }
+        if (config.queue_mode == queue_mode_t::split) {
+            band.queueTransfer = cl::CommandQueue(context, devices[b], cl::QueueProperties::Profiling);
+        } else {
+            band.queueTransfer = band.queueCompute;
+        }
+        if (traceEnabled()) {
+            std::string name = "band " + std::to_string(b);
+            if (config.queue_mode == queue_mode_t::split) {
+                trace_tracks[band.queueCompute()] = traceTrack(name + " compute");
+                trace_tracks[band.queueTransfer()] = traceTrack(name + " transfer");
+            } else {
+                trace_tracks[band.queueCompute()] = traceTrack(name);
+            }
+        }
+        if (nbands > 1) {
+            log->info() << "band " << b << ": rows " << band.y0 << " to " << band.y0 + band.rows - 1 << " on " << devices[b].getInfo<CL_DEVICE_NAME>();
+        }
+    }
+}
+
+Pipeline::~Pipeline() {
+    // the mapped outputs have to be handed back before the buffers are released
+    try {
+        drain();
+        cl::CommandQueue& queue = bands.front().queueTransfer;
+        for (auto& texture : textures) {
+            if (texture.mapped) {
+                queue.enqueueUnmapMemObject(texture.dTextures[0], texture.mapped);
+                texture.mapped = nullptr;
+            }
+        }
+        for (auto& chunk : audio_chunks) {
+            if (chunk.mapped) {
+                queue.enqueueUnmapMemObject(chunk.dSamples, chunk.mapped);
+                chunk.mapped = nullptr;
+            }
+        }
+        queue.finish();
+    } catch (const std::exception& e) {
+        log->warn() << "could not release the pipeline outputs: " << e.what();
+    }
+}
+
+void Pipeline::make_automaton_kernels() {
+    std::size_t n = config.n;
+    std::size_t m = config.m;
+    std::size_t automaton_tile = config.automaton_tile;
+    bool temporal = config.generations_per_launch > 1;
+    automaton_kernel_t automaton_kernel = config.automaton_kernel;
+    if (!temporal && automaton_kernel == automaton_kernel_t::specialized) {
+        if (specializer.specialized()) {
+            log->info() << "specialized automaton kernel with " << specializer.taps() << " of " << 9 * m * m << " rule taps";
+        } else {
+            log->info() << "rules too dense (" << specializer.taps() << " of " << 9 * m * m << " taps), use generic automaton kernel";
+            automaton_kernel = automaton_kernel_t::generic;
+        }
+    }
+    bool specialized = !temporal && automaton_kernel == automaton_kernel_t::specialized;
+    bool automaton_tiles = temporal || sparse || fused || automaton_kernel == automaton_kernel_t::tiled;
+    if (automaton_tiles) {
+        automatonLocal = cl::NDRange(automaton_tile, automaton_tile);
+    } else if (config.local_width > 0 && specialized) {
+        automatonLocal = cl::NDRange(config.local_width, config.local_height);
+    } else if (config.local_width > 0) {
+        automatonLocal = cl::NDRange(config.local_width, config.local_height, 1);
+    } else {
+        automatonLocal = cl::NullRange;
+    }
+
+    for (std::size_t b = 0; b < bands.size(); ++b) {
+        band_t& band = bands[b];
+        cl::Program program = programAutomaton;
+        const char* name = "automaton";
+        if (temporal) {
+            name = "automaton_temporal";
+            band.automatonGlobal = cl::NDRange(n, band.rows);
+        } else if (specialized) {
+            program = specializer.kernel().getInfo<CL_KERNEL_PROGRAM>();
+            name = "automaton_specialized";
+            band.automatonGlobal = cl::NDRange(n / vector_cells, band.rows);
+        } else if (sparse) {
+            name = "automaton_sparse";
+            band.automatonGlobal = cl::NDRange(n, band.rows);
+        } else if (fused) {
+            name = "automaton_fused";
+            band.automatonGlobal = cl::NDRange(n, band.rows);
+        } else if (automaton_kernel == automaton_kernel_t::tiled) {
+            name = "automaton_tiled";
+            band.automatonGlobal = cl::NDRange(n, band.rows);
+        } else if (vector_cells > 1) {
+            name = "automaton_planar";
+            band.automatonGlobal = cl::NDRange(n / vector_cells, band.rows, m);
+        } else {
+            band.automatonGlobal = cl::NDRange(n, band.rows, m);
+        }
+
+        for (std::size_t parity = 0; parity < 2; ++parity) {
+            // odd frames read dState0 and write dState1, even frames the other way around
+            cl::Kernel& kernelAutomaton = band.kernelAutomaton[parity];
+            kernelAutomaton = cl::Kernel(program, name);
+            kernelAutomaton.setArg(0, parity ? band.dState0 : band.dState1);
+            kernelAutomaton.setArg(1, parity ? band.dState1 : band.dState0);
+            if (!specialized) {
+                kernelAutomaton.setArg(2, dRules);
+            }
+            if (temporal) {
+                kernelAutomaton.setArg(3, dPartial);
+            }
+            if (fused) {
+                kernelAutomaton.setArg(3, band.dPartial);
+                kernelAutomaton.setArg(5, dColors);
+            }
+            if (sparse) {
+                kernelAutomaton.setArg(3, dTiles);
+                kernelAutomaton.setArg(4, dTileCount);
+                kernelAutomaton.setArg(5, dChanged[parity]);
+            }
+        }
+        if (automaton_tiles) {
+            myassert(band.kernelAutomaton[0].getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[b]) >= automaton_tile * automaton_tile, "automaton_tile too large for device");
+            std::size_t local_bytes = automaton_local_bytes(config);
+            std::size_t local_mem = static_cast<std::size_t>(devices[b].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>());
+            myassert(local_bytes <= local_mem, "the automaton tiles need " + std::to_string(local_bytes) + " bytes of local memory, the device has " + std::to_string(local_mem) + ", lower automaton_tile or m");
+        }
+    }
+}
+
+bool Pipeline::poll() {
+    bool progress = false;
+
+    // retire in order, only block if every frame slot is taken
+    while (frames.retire_ready()) {
+        retire();
+        progress = true;
+    }
+
+    if (has_room() && (frame_limit == 0 || frames.submitted() < frame_limit)) {
+        submit();
+        progress = true;
+    }
+
+    return progress;
+}
+
+void Pipeline::drain() {
+    while (frames.in_flight() > 0) {
+        retire();
+    }
+}
+
+void Pipeline::step() {
+    drain();
+    myassert(has_room(), "no room in the audiobuffer for another frame");
+    submit();
+    retire();
+}
+
+std::vector<float> Pipeline::read_state() {
+    drain();
+    std::size_t row_size = stateValueSize(config.state_format) * config.n * config.m;
+    std::vector<unsigned char> data(row_size * config.n);
+    for (auto& band : bands) {
+        // the state the next frame starts from, without the halo rows
+        cl::Buffer& dState = flipflop ? band.dState0 : band.dState1;
+        band.queueTransfer.enqueueReadBuffer(dState, true, halo_rows * row_size, band.rows * row_size, data.data() + band.y0 * row_size);
+    }
+    return fromStateLayout(decodeState(data, config.state_format), config.m, config.state_layout);
+}
+
+void Pipeline::set_frame_limit(std::size_t frames) {
+    frame_limit = frames;
+}
+
+void Pipeline::set_stats_callback(std::function<void(const frame_stats_t&)> callback) {
+    stats_callback = callback;
+}
+
+void Pipeline::request_snapshot(std::function<void(state_snapshot_t)> callback) {
+    std::size_t row_size = stateValueSize(config.state_format) * config.n * config.m;
+    auto data = std::make_shared<std::vector<unsigned char>>(row_size * config.n);
+    state_format_t format = config.state_format;
+    state_layout_t layout = config.state_layout;
+    std::size_t m = config.m;
+    state_snapshot_t snapshot;
+    snapshot.generations = generations;
+    snapshot.t = t;
+    snapshot.bytes = data->size();
+    snapshot.decode = [data, format, layout, m]() {
+        return fromStateLayout(decodeState(*data, format), m, layout);
+    };
+
+    if (frames.in_flight() == 0) {
+        for (auto& band : bands) {
+            cl::Buffer& dState = flipflop ? band.dState0 : band.dState1;
+            band.queueTransfer.enqueueReadBuffer(dState, true, halo_rows * row_size, band.rows * row_size, data->data() + band.y0 * row_size);
+        }
+        callback(snapshot);
+        return;
+    }
+
+    // the rows of the newest frame, downloaded next to its other results
+    frame_t& frame = frames.newest();
+    myassert(!frame.snapshot_callback, "a snapshot of this frame is pending already");
+    std::size_t parity = flipflop ? 0 : 1;
+    for (std::size_t b = 0; b < bands.size(); ++b) {
+        band_t& band = bands[b];
+        cl::Buffer& dState = flipflop ? band.dState0 : band.dState1;
+        waits.download = {frame.evts_automaton[b]};
+        frame.evts_download.push_back(cl::Event());
+        band.queueTransfer.enqueueReadBuffer(dState, false, halo_rows * row_size, band.rows * row_size, data->data() + band.y0 * row_size, &waits.download, &frame.evts_download.back());
+        band.queueTransfer.flush();
+        // the automaton two frames later overwrites these rows
+        band.evts_state_readers[parity].push_back(frame.evts_download.back());
+    }
+    frame.snapshot = snapshot;
+    frame.snapshot_callback = callback;
+}
+
+void Pipeline::set_clock(std::uint64_t generations, float t) {
+    myassert(frames.submitted() == 0, "the clock can only be set before the first frame");
+    this->generations = generations;
+    this->t = t;
+}
+
+std::size_t Pipeline::audiobuffer_blocks(const config_t& config) {
+    std::size_t k = config.generations_per_launch;
+    std::size_t blocks = (config.sample_rate / 2 + config.nsamples - 1) / config.nsamples + config.frames_in_flight * k;
+    return (blocks + k - 1) / k * k;
+}
+
+std::size_t Pipeline::automaton_local_bytes(const config_t& config) {
+    automaton_kernel_t kernel = config.automaton_kernel;
+    bool temporal = config.generations_per_launch > 1;
+    bool fused = !temporal && kernel == automaton_kernel_t::fused;
+    if (!temporal && !fused && kernel != automaton_kernel_t::tiled && kernel != automaton_kernel_t::sparse) {
+        return 0;
+    }
+    // the tile plus its halo (twice for the temporal kernel), and the reduction lanes
+    std::size_t tile = config.automaton_tile;
+    std::size_t span = tile + 2 * config.generations_per_launch;
+    std::size_t floats = (temporal ? 2 : 1) * span * span * config.m + (temporal || fused ? tile * tile : 0);
+    return sizeof(cl_float) * floats;
+}
+
+std::vector<std::size_t> Pipeline::band_rows(const config_t& config) {
+    std::size_t unit = automaton_local_bytes(config) > 0 ? config.automaton_tile : 1;
+    std::size_t units = config.n / unit;
+    std::vector<std::size_t> rows;
+    for (std::size_t b = 0; b < config.bands; ++b) {
+        rows.push_back((units / config.bands + (b < units % config.bands ? 1 : 0)) * unit);
+    }
+    return rows;
+}
+
+std::vector<cl::Device> Pipeline::select_devices(const config_t& config, const std::vector<cl::Device>& available) {
+    std::vector<cl::Device> devices;
+    for (cl::Device device : available) {
+        if (devices.size() >= config.bands) {
+            break;
+        }
+        std::vector<cl::Device> parts;
+        try {
+            if (config.device_fission == device_fission_t::numa) {
+                const cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+                device.createSubDevices(properties, &parts);
+            } else if (config.device_fission == device_fission_t::equally) {
+                cl_uint units = std::max<cl_uint>(device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() / static_cast<cl_uint>(config.bands), 1);
+                const cl_device_partition_property properties[] = {CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(units), 0};
+                device.createSubDevices(properties, &parts);
+            }
+        } catch (const cl::Error&) {
+            // not every device can be split, use it as a whole then
+            parts.clear();
+        }
+        if (parts.empty()) {
+            parts.push_back(device);
+        }
+        devices.insert(devices.end(), parts.begin(), parts.end());
+    }
+    myassert(devices.size() >= config.bands, "not enough devices for " + std::to_string(config.bands) + " bands");
+    devices.resize(config.bands);
+    return devices;
+}
+
+bool Pipeline::has_room() const {
+    // keep at most half a second of audio queued, including the blocks of all frames in flight, and no more than the
+    // audio sink asks for
+    std::size_t blocks = audiobuffer->occupancy() + audio_reserved + config.generations_per_launch;
+    return frames.has_slot()
+        && audiobuffer->write_available() >= audio_reserved + config.generations_per_launch
+        && static_cast<float>((blocks - 1) * config.nsamples) < static_cast<float>(config.sample_rate) * 0.5f
+        && blocks <= std::max(audiobuffer->fill_target(), config.generations_per_launch);
+}
+
+void Pipeline::submit() {
+    std::size_t n = config.n;
+    std::size_t m = config.m;
+    std::size_t nsamples = config.nsamples;
+    std::size_t generations_per_launch = config.generations_per_launch;
+    bool temporal = generations_per_launch > 1;
+    std::size_t row_size = stateValueSize(config.state_format) * n * m;
+    band_t& primary = bands.front();
+    frame_t& frame = frames.next();
+    frame.submitted = std::chrono::steady_clock::now();
+    frame.submitted_trace = traceEnabled() ? traceNow() : 0;
+    TraceScope trace("submit");
+
+    // everything below reuses the storage of the last frames, so the steady state does not allocate
+    std::size_t parity = flipflop ? 1 : 0;
+    auto stateOut = [&](band_t& band) -> cl::Buffer& {
+        return flipflop ? band.dState1 : band.dState0;
+    };
+    frame.evts_activate.clear();
+    frame.evts_automaton.clear();
+    frame.evts_visualize.clear();
+    frame.evts_halo.clear();
+    frame.evts_render.clear();
+    frame.evts_reduce.clear();
+    frame.evts_download.clear();
+
+    HOT_DEBUG(log, "select output buffers");
+    // mapped outputs are handed back to the device before they get overwritten, this only happens with one band
+    frame.texture = textures_free.back();
+    textures_free.pop_back();
+    texture_t& texture = textures[frame.texture];
+    waits.texture_free.clear();
+    if (texture.mapped) {
+        waits.texture_free.push_back(cl::Event());
+        primary.queueTransfer.enqueueUnmapMemObject(texture.dTextures[0], texture.mapped, nullptr, &waits.texture_free.back());
+        texture.mapped = nullptr;
+    }
+    cl::Buffer* dSamplesOut = &frame.dSamples;
+    audio_chunk_t* chunk = nullptr;
+    waits.samples_free.clear();
+    if (!audio_chunks.empty()) {
+        std::size_t offset = static_cast<std::size_t>(audiobuffer->write_block(audio_reserved) - audiobuffer->data());
+        chunk = &audio_chunks[offset / (generations_per_launch * nsamples)];
+        if (chunk->mapped) {
+            waits.samples_free.push_back(cl::Event());
+            primary.queueTransfer.enqueueUnmapMemObject(chunk->dSamples, chunk->mapped, nullptr, &waits.samples_free.back());
+            chunk->mapped = nullptr;
+        }
+        dSamplesOut = &chunk->dSamples;
+    }
+    primary.queueTransfer.flush();
+
+    HOT_DEBUG(log, "run automaton kernels");
+    for (std::size_t b = 0; b < bands.size(); ++b) {
+        band_t& band = bands[b];
+        // reads the previous state and overwrites the one the stages of the frame before last read
+        std::vector<cl::Event>& waitAutomaton = waits.automaton;
+        waitAutomaton = band.evts_state_readers[parity];
+        waitAutomaton.insert(waitAutomaton.end(), band.evts_halo.begin(), band.evts_halo.end());
+        if (band.evt_last_automaton()) {
+            waitAutomaton.push_back(band.evt_last_automaton);
+        }
+        if ((temporal || fused) && evt_last_audio()) {
+            // dPartial is written by the automaton kernel
+            waitAutomaton.push_back(evt_last_audio);
+        }
+        if (fused) {
+            band.kernelAutomaton[parity].setArg(4, texture.dTextures[b]);
+            waitAutomaton.insert(waitAutomaton.end(), waits.texture_free.begin(), waits.texture_free.end());
+        }
+        if (sparse) {
+            HOT_DEBUG(log, "collect active tiles");
+            std::size_t tiles = config.n / config.automaton_tile;
+            if (evt_last_tile_count()) {
+                waitAutomaton.push_back(evt_last_tile_count);
+            }
+            frame.evts_activate.resize(2);
+            band.queueCompute.enqueueFillBuffer(dTileCount, static_cast<cl_uint>(0), 0, sizeof(cl_uint), &waitAutomaton, &frame.evts_activate[0]);
+            waits.activate = {frame.evts_activate[0]};
+            band.queueCompute.enqueueNDRangeKernel(kernelActivate[parity], cl::NullRange, cl::NDRange(tiles, tiles), cl::NullRange, &waits.activate, &frame.evts_activate[1]);
+            waitAutomaton = {frame.evts_activate[1]};
+        }
+        frame.evts_automaton.push_back(cl::Event());
+        band.queueCompute.enqueueNDRangeKernel(band.kernelAutomaton[parity], cl::NullRange, band.automatonGlobal, automatonLocal, &waitAutomaton, &frame.evts_automaton.back());
+        band.evt_last_automaton = frame.evts_automaton.back();
+        band.evts_state_readers[parity].clear();
+    }
+
+    if (bands.size() > 1) {
+        HOT_DEBUG(log, "exchange halo rows");
+        // every device only touches its own buffers, the rows travel through the host staging areas
+        for (auto& band : bands) {
+            band.evts_edges.resize(2);
+            // the staging area of the last frame has to be uploaded by the neighbours before it is overwritten
+            waits.edges = band.evts_edge_readers;
+            waits.edges.push_back(band.evt_last_automaton);
+            band.queueCompute.enqueueReadBuffer(stateOut(band), false, halo_rows * row_size, row_size, band.hEdges.get(), &waits.edges, &band.evts_edges[0]);
+            band.queueCompute.enqueueReadBuffer(stateOut(band), false, (halo_rows + band.rows - 1) * row_size, row_size, band.hEdges.get() + row_size, &waits.edges, &band.evts_edges[1]);
+            band.evts_edge_readers.clear();
+            band.evts_state_readers[parity].insert(band.evts_state_readers[parity].end(), band.evts_edges.begin(), band.evts_edges.end());
+            frame.evts_halo.insert(frame.evts_halo.end(), band.evts_edges.begin(), band.evts_edges.end());
+        }
+        for (std::size_t b = 0; b < bands.size(); ++b) {
+            band_t& band = bands[b];
+            band_t& above = bands[(b + bands.size() - 1) % bands.size()];
+            band_t& below = bands[(b + 1) % bands.size()];
+            band.evts_halo.resize(2);
+
+            // the last row of the band above becomes the upper halo row, the first row of the band below the lower one
+            waits.above = {above.evts_edges[1], frame.evts_automaton[b]};
+            band.queueCompute.enqueueWriteBuffer(stateOut(band), false, 0, row_size, above.hEdges.get() + row_size, &waits.above, &band.evts_halo[0]);
+            waits.below = {below.evts_edges[0], frame.evts_automaton[b]};
+            band.queueCompute.enqueueWriteBuffer(stateOut(band), false, (halo_rows + band.rows) * row_size, row_size, below.hEdges.get(), &waits.below, &band.evts_halo[1]);
+
+            above.evts_edge_readers.push_back(band.evts_halo[0]);
+            below.evts_edge_readers.push_back(band.evts_halo[1]);
+            frame.evts_halo.insert(frame.evts_halo.end(), band.evts_halo.begin(), band.evts_halo.end());
+        }
+    }
+
+    HOT_DEBUG(log, "run visualization kernels");
+    for (std::size_t b = 0; b < bands.size() && !fused; ++b) {
+        band_t& band = bands[b];
+        band.kernelVisualize[parity].setArg(1, texture.dTextures[b]);
+        waits.visualize = {frame.evts_automaton[b]};
+        waits.visualize.insert(waits.visualize.end(), waits.texture_free.begin(), waits.texture_free.end());
+        frame.evts_visualize.push_back(cl::Event());
+        band.queueCompute.enqueueNDRangeKernel(band.kernelVisualize[parity], cl::NullRange, cl::NDRange(n / vector_cells, band.rows), visualizeLocal, &waits.visualize, &frame.evts_visualize.back());
+        band.evts_state_readers[parity].push_back(frame.evts_visualize.back());
+    }
+
+    // the audio scratch buffers are shared between frames, the final stage on the first device waits for all bands
+    std::vector<cl::Event>& waitLastAudio = waits.last_audio;
+    std::vector<cl::Event>& waitAudio = waits.audio;
+    std::vector<cl::Event>& waitGathered = waits.gathered;
+    waitLastAudio = waits.samples_free;
+    if (evt_last_audio()) {
+        waitLastAudio.push_back(evt_last_audio);
+    }
+    waitGathered.clear();
+    if (config.render_mode == render_mode_t::samples) {
+        // every band renders its cells in chunks of render_chunk cells, the first reduction pass of every chunk folds
+        // its blocks into the same ngroups partial blocks, a second pass (if required) combines those of all bands
+        float norm = static_cast<float>(config.reduction_size) / static_cast<float>(n * n);
+        bool direct = false;
+        for (std::size_t b = 0; b < bands.size(); ++b) {
+            band_t& band = bands[b];
+            waitAudio = {frame.evts_automaton[b]};
+            waitAudio.insert(waitAudio.end(), waitLastAudio.begin(), waitLastAudio.end());
+            HOT_DEBUG(log, "run render and reduction kernels");
+            direct = enqueueRenderChunks(band.queueCompute, band.kernelRender[parity], band.kernelReduce, band.dBuffer0, band.dBuffer1, *dSamplesOut, config, halo_rows * n, n * band.rows, band.ngroups, 1, t, norm, bands.size() == 1, waitAudio, frame.evts_render, frame.evts_reduce, &band.evts_state_readers[parity]);
+            if (&band != &primary) {
+                HOT_DEBUG(log, "gather partial blocks");
+                frame.evts_reduce.push_back(cl::Event());
+                primary.queueCompute.enqueueCopyBuffer(band.dBuffer1, dBuffer1, 0, sizeof(cl_float) * band.group_offset * nsamples, sizeof(cl_float) * band.ngroups * nsamples, &waitAudio, &frame.evts_reduce.back());
+                waitAudio = {frame.evts_reduce.back()};
+            }
+            waitGathered.insert(waitGathered.end(), waitAudio.begin(), waitAudio.end());
+        }
+        if (!direct) {
+            HOT_DEBUG(log, "run final reduction kernel");
+            enqueueReduceFinal(primary.queueCompute, primary.kernelReduce, dBuffer1, *dSamplesOut, config, ngroups, 1, norm, waitGathered, frame.evts_reduce);
+        }
+    } else {
+        if (temporal) {
+            // the automaton kernel already wrote per-level sums for every generation
+            waitGathered = {frame.evts_automaton.front()};
+            waitGathered.insert(waitGathered.end(), waitLastAudio.begin(), waitLastAudio.end());
+        } else {
+            for (std::size_t b = 0; b < bands.size(); ++b) {
+                band_t& band = bands[b];
+
+                // the fused automaton kernel already wrote the per-level sums of the band
+                waitAudio = {frame.evts_automaton[b]};
+                waitAudio.insert(waitAudio.end(), waitLastAudio.begin(), waitLastAudio.end());
+                if (!fused) {
+                    HOT_DEBUG(log, "run amplitudes kernel");
+                    enqueueAmplitudes(band.queueCompute, band.kernelAmplitudes[parity], config, band.ngroups, 1, waitAudio, frame.evts_render, &band.evts_state_readers[parity]);
+                }
+
+                if (&band != &primary) {
+                    HOT_DEBUG(log, "gather partial sums");
+                    frame.evts_reduce.push_back(cl::Event());
+                    primary.queueCompute.enqueueCopyBuffer(band.dPartial, dPartial, 0, sizeof(cl_float) * band.group_offset * m, sizeof(cl_float) * band.ngroups * m, &waitAudio, &frame.evts_reduce.back());
+                    waitAudio = {frame.evts_reduce.back()};
+                }
+                waitGathered.insert(waitGathered.end(), waitAudio.begin(), waitAudio.end());
+            }
+        }
+
+        HOT_DEBUG(log, "run synthesize kernel");
+        enqueueSynthesize(primary.queueCompute, kernelSynthesize, *dSamplesOut, config, 1, t, waitGathered, frame.evts_reduce);
+    }
+    evt_last_audio = frame.evts_reduce.back();
+    for (auto& band : bands) {
+        band.queueCompute.flush();
+    }
+
+    HOT_DEBUG(log, "download visualization and rendered audio data");
+    std::vector<cl::Event>& waitDownload = waits.download;
+    for (std::size_t b = 0; b < bands.size(); ++b) {
+        band_t& band = bands[b];
+        waitDownload = {fused ? frame.evts_automaton[b] : frame.evts_visualize[b]};
+        frame.evts_download.push_back(cl::Event());
+        if (zero_copy) {
+            texture.mapped = static_cast<unsigned char*>(band.queueTransfer.enqueueMapBuffer(texture.dTextures[b], false, CL_MAP_READ, 0, sizeof(cl_uchar4) * n * n, &waitDownload, &frame.evts_download.back()));
+        } else {
+            // every band fills its rows of the host texture
+            band.queueTransfer.enqueueReadBuffer(texture.dTextures[b], false, 0, sizeof(cl_uchar4) * n * band.rows, texture.host.get() + sizeof(cl_uchar4) * n * band.y0, &waitDownload, &frame.evts_download.back());
+        }
+    }
+    frame.active_tiles = 0;
+    if (sparse) {
+        // the count is reset by the next launch
+        waitDownload = {frame.evts_activate.back()};
+        frame.evts_download.push_back(cl::Event());
+        primary.queueTransfer.enqueueReadBuffer(dTileCount, false, 0, sizeof(cl_uint), &frame.active_tiles, &waitDownload, &frame.evts_download.back());
+        evt_last_tile_count = frame.evts_download.back();
+    }
+    waitDownload = {evt_last_audio};
+    if (chunk) {
+        // CL_MEM_USE_HOST_PTR: mapping makes the samples visible in the audio ring
+        frame.evts_download.push_back(cl::Event());
+        chunk->mapped = primary.queueTransfer.enqueueMapBuffer(chunk->dSamples, false, CL_MAP_READ, 0, sizeof(float) * generations_per_launch * nsamples, &waitDownload, &frame.evts_download.back());
+    } else {
+        for (std::size_t block = 0; block < generations_per_launch; ++block) {
+            frame.evts_download.push_back(cl::Event());
+            primary.queueTransfer.enqueueReadBuffer(frame.dSamples, false, sizeof(float) * block * nsamples, sizeof(float) * nsamples, audiobuffer->write_block(audio_reserved + block), &waitDownload, &frame.evts_download.back());
+        }
+    }
+    for (auto& band : bands) {
+        band.queueTransfer.flush();
+    }
+
+    audio_reserved += generations_per_launch;
+    frames.push();
+    flipflop = !flipflop;
+    t += static_cast<float>(generations_per_launch * nsamples) / static_cast<float>(config.sample_rate);
+    generations += generations_per_launch;
+}
+
+void Pipeline::retire() {
+    frame_t& frame = frames.oldest();
+    TraceScope trace("retire");
+
+    HOT_DEBUG(log, "wait for downloads");
+    {
+        TraceScope trace_wait("wait for downloads");
+        cl::Event::waitForEvents(frame.evts_download);
+    }
+
+    HOT_DEBUG(log, "publish visualization");
+    texture_t& texture = textures[frame.texture];
+    texture_view_t& view = hTexture->back();
+    view.data = texture.mapped ? texture.mapped : texture.host.get();
+    view.version = frames.retired() + 1;
+    view.slot = frame.texture;
+    hTexture->publish();
+    // the back slot is owned by us again, its texture is neither displayed nor pending
+    texture_view_t& released = hTexture->back();
+    if (released.data) {
+        textures_free.push_back(released.slot);
+        released.data = nullptr;
+    }
+    audiobuffer->commit_write(config.generations_per_launch);
+    audio_reserved -= config.generations_per_launch;
+    frames.pop();
+
+    if (stats_callback) {
+        stats_callback(collect_stats(frame));
+    }
+    if (frame.snapshot_callback) {
+        // taken out first, the callback may request the next snapshot
+        std::function<void(state_snapshot_t)> callback = std::move(frame.snapshot_callback);
+        frame.snapshot_callback = nullptr;
+        callback(std::move(frame.snapshot));
+    }
+    if (traceEnabled()) {
+        trace_device(frame);
+        traceCounter("audiobuffer blocks", static_cast<double>(audiobuffer->occupancy()));
+        traceCounter("audiobuffer target", static_cast<double>(audiobuffer->fill_target()));
+    }
+
+    if (config.profiling_interval > 0 && ++profiling_counter >= config.profiling_interval) {
+        profiling_counter = 0;
+        frame_stats_t stats = collect_stats(frame);
+        log->info() << "Profiling data: automaton=" << stats.automaton << "ms visualize=" << stats.visualize << "ms halo=" << stats.halo << "ms render=" << stats.render << "ms reduce=" << stats.reduce << "ms download=" << stats.download << "ms host=" << stats.host << "ms active_tiles=" << stats.active_tiles << " audiobuffer=" << audiobuffer->occupancy() << "/" << audiobuffer->blocks() << " underruns=" << audiobuffer->underruns();
+    }
+}
+
+void Pipeline::trace_device(const frame_t& frame) const {
+    const std::pair<const char*, const std::vector<cl::Event>*> stages[] = {
+        {"activate", &frame.evts_activate},
+        {"automaton", &frame.evts_automaton},
+        {"visualize", &frame.evts_visualize},
+        {"halo", &frame.evts_halo},
+        {"render", &frame.evts_render},
+        {"reduce", &frame.evts_reduce},
+        {"download", &frame.evts_download}
+    };
+
+    // device clocks are unrelated to the host clock, so the first command of every queue is placed at the time the frame
+    // was submitted. Calibrating every frame keeps the clocks from drifting apart, at the cost of the queueing delay.
+    std::map<cl_command_queue, cl_ulong> first_queued;
+    for (const auto& stage : stages) {
+        for (const auto& evt : *stage.second) {
+            cl_command_queue queue = evt.getInfo<CL_EVENT_COMMAND_QUEUE>()();
+            cl_ulong queued = evt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+            auto it = first_queued.find(queue);
+            if (it == first_queued.end() || queued < it->second) {
+                first_queued[queue] = queued;
+            }
+        }
+    }
+    for (const auto& stage : stages) {
+        for (const auto& evt : *stage.second) {
+            cl_command_queue queue = evt.getInfo<CL_EVENT_COMMAND_QUEUE>()();
+            auto track = trace_tracks.find(queue);
+            if (track == trace_tracks.end()) {
+                continue;
+            }
+            cl_ulong base = first_queued[queue];
+            cl_ulong start = evt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            cl_ulong end = evt.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+            traceSpan(stage.first, frame.submitted_trace + (start - base), frame.submitted_trace + (end - base), track->second);
+        }
+    }
+}
+
+frame_stats_t Pipeline::collect_stats(const frame_t& frame) const {
+    frame_stats_t stats;
+    stats.automaton = getEventsTimeMS(frame.evts_activate) + getEventsTimeMS(frame.evts_automaton);
+    stats.active_tiles = frame.active_tiles;
+    stats.visualize = getEventsTimeMS(frame.evts_visualize);
+    stats.halo = getEventsTimeMS(frame.evts_halo);
+    stats.render = getEventsTimeMS(frame.evts_render);
+    stats.reduce = getEventsTimeMS(frame.evts_reduce);
+    stats.download = getEventsTimeMS(frame.evts_download);
+    stats.host = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frame.submitted).count();
+    return stats;
+}
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+#include "pulse.hpp"
+#include "trace.hpp"
+
+
+namespace {
+
+// the callbacks run with the mainloop locked, everybody else has to lock it as well
+class MainloopLock {
+    public:
+        explicit MainloopLock(pa_threaded_mainloop* mainloop) : mainloop(mainloop) {
+            pa_threaded_mainloop_lock(mainloop);
+        }
+
+        ~MainloopLock() {
+            pa_threaded_mainloop_unlock(mainloop);
+        }
+
+        MainloopLock(const MainloopLock&) = delete;
+        MainloopLock& operator=(const MainloopLock&) = delete;
+
+    private:
+        pa_threaded_mainloop* mainloop;
+};
+
+}
+
+
+PulseAudioSink::PulseAudioSink(const config_t& config, const shared_buffer_t<float>& audiobuffer, const std::shared_ptr<spdlog::logger>& log)
+    : AudioSink(config, audiobuffer, log, config.audio_latency / 2) {
+    spec.format = PA_SAMPLE_FLOAT32LE;
+    spec.rate = static_cast<std::uint32_t>(config.sample_rate);
+    spec.channels = 1;
+    // the server never needs to hold more than the audiobuffer
+    max_tlength = audiobuffer->blocks() * audiobuffer->block_size() * sizeof(float);
+
+    try {
+        mainloop = pa_threaded_mainloop_new();
+        myassert(mainloop != nullptr, "cannot create pulseaudio mainloop");
+        context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "s2015ocl");
+        myassert(context != nullptr, "cannot create pulseaudio context");
+        pa_context_set_state_callback(context, on_context_state, this);
+        if (pa_context_connect(context, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+            throw_error("pa_context_connect");
+        }
+        myassert(pa_threaded_mainloop_start(mainloop) >= 0, "cannot start pulseaudio mainloop");
+
+        MainloopLock lock(mainloop);
+        for (pa_context_state_t state = pa_context_get_state(context); state != PA_CONTEXT_READY; state = pa_context_get_state(context)) {
+            if (!PA_CONTEXT_IS_GOOD(state)) {
+                throw_error("pa_context_connect");
+            }
+            pa_threaded_mainloop_wait(mainloop);
+        }
+
+        stream = pa_stream_new(context, "playback", &spec, nullptr);
+        if (!stream) {
+            throw_error("pa_stream_new");
+        }
+        pa_stream_set_state_callback(stream, on_stream_state, this);
+        pa_stream_set_write_callback(stream, on_write, this);
+        pa_stream_set_underflow_callback(stream, on_underflow, this);
+
+        // with PA_STREAM_ADJUST_LATENCY, tlength is the latency of the whole server side including the device
+        pa_buffer_attr attr;
+        attr.maxlength = static_cast<std::uint32_t>(-1);
+        attr.tlength = static_cast<std::uint32_t>(std::min(max_tlength, pa_usec_to_bytes(config.audio_latency * 1000 / 2, &spec)));
+        attr.prebuf = static_cast<std::uint32_t>(-1);
+        attr.minreq = static_cast<std::uint32_t>(-1);
+        attr.fragsize = static_cast<std::uint32_t>(-1);
+        pa_stream_flags_t flags = static_cast<pa_stream_flags_t>(PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+        if (pa_stream_connect_playback(stream, nullptr, &attr, flags, nullptr, nullptr) < 0) {
+            throw_error("pa_stream_connect_playback");
+        }
+        for (pa_stream_state_t state = pa_stream_get_state(stream); state != PA_STREAM_READY; state = pa_stream_get_state(stream)) {
+            if (!PA_STREAM_IS_GOOD(state)) {
+                throw_error("pa_stream_connect_playback");
+            }
+            pa_threaded_mainloop_wait(mainloop);
+        }
+        log->info() << "pulseaudio buffer " << pa_stream_get_buffer_attr(stream)->tlength << " bytes";
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+PulseAudioSink::~PulseAudioSink() {
+    close();
+}
+
+void PulseAudioSink::run(const shared_atomic_t<bool>& shutdown) {
+    // the samples are written by the mainloop, only watch it here
+    while (!(*shutdown)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        MainloopLock lock(mainloop);
+        if (failed || !PA_STREAM_IS_GOOD(pa_stream_get_state(stream))) {
+            throw_error("pulseaudio stream failed");
+        }
+        pa_usec_t usec;
+        int negative;
+        if (pa_stream_get_latency(stream, &usec, &negative) == 0) {
+            set_backend_latency(negative ? 0 : static_cast<std::size_t>(usec * sample_rate / 1000000));
+        }
+    }
+}
+
+void PulseAudioSink::on_context_state(pa_context* /*c*/, void* userdata) {
+    pa_threaded_mainloop_signal(static_cast<PulseAudioSink*>(userdata)->mainloop, 0);
+}
+
+void PulseAudioSink::on_stream_state(pa_stream* /*s*/, void* userdata) {
+    pa_threaded_mainloop_signal(static_cast<PulseAudioSink*>(userdata)->mainloop, 0);
+}
+
+void PulseAudioSink::on_write(pa_stream* s, std::size_t nbytes, void* userdata) {
+    auto sink = static_cast<PulseAudioSink*>(userdata);
+    if (!sink->named) {
+        traceThreadName("pulse mainloop");
+        sink->named = true;
+    }
+
+    // fill the memory of the server directly
+    void* data = nullptr;
+    std::size_t bytes = nbytes;
+    if (pa_stream_begin_write(s, &data, &bytes) < 0 || !data) {
+        sink->failed = true;
+        return;
+    }
+    std::size_t count = bytes / sizeof(float);
+    sink->pull(static_cast<float*>(data), count);
+    if (pa_stream_write(s, data, count * sizeof(float), nullptr, 0, PA_SEEK_RELATIVE) < 0) {
+        sink->failed = true;
+    }
+}
+
+void PulseAudioSink::on_underflow(pa_stream* s, void* userdata) {
+    auto sink = static_cast<PulseAudioSink*>(userdata);
+    sink->note_backend_underrun();
+
+    // the mainloop did not keep up, give the server a larger buffer
+    const pa_buffer_attr* current = pa_stream_get_buffer_attr(s);
+    if (current && current->tlength < sink->max_tlength) {
+        pa_buffer_attr attr = *current;
+        attr.tlength = static_cast<std::uint32_t>(std::min<std::size_t>(sink->max_tlength, attr.tlength + attr.tlength / 2));
+        pa_operation* op = pa_stream_set_buffer_attr(s, &attr, nullptr, nullptr);
+        if (op) {
+            pa_operation_unref(op);
+        }
+        sink->log->warn() << "pulseaudio underrun, buffer " << attr.tlength << " bytes from now on";
+    } else {
+        sink->log->warn() << "pulseaudio underrun";
+    }
+}
+
+void PulseAudioSink::throw_error(const char* what) {
+    const char* estring = context ? pa_strerror(pa_context_errno(context)) : nullptr;
+    throw MyException(std::string(what) + ": " + (estring ? estring : "unknown error"));
+}
+
+void PulseAudioSink::close() {
+    if (!mainloop) {
+        return;
+    }
+    {
+        MainloopLock lock(mainloop);
+        if (stream) {
+            pa_stream_disconnect(stream);
+            pa_stream_unref(stream);
+            stream = nullptr;
+        }
+        if (context) {
+            pa_context_disconnect(context);
+            pa_context_unref(context);
+            context = nullptr;
+        }
+    }
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+    mainloop = nullptr;
+}
@@ -0,0 +1,141 @@
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include "kernels.hpp"
+#include "rulegen.hpp"
+
+
+namespace {
+
+// hex float literal, round-trips exactly
+std::string floatLiteral(float v) {
+    myassert(std::isfinite(v), "rules must be finite");
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%af", static_cast<double>(v));
+    return buf;
+}
+
+// RIDX_OTHER for signed offsets
+std::size_t ruleIndex(std::size_t m, int dx, int dy, std::size_t ltarget, std::size_t lsource) {
+    return m * m * static_cast<std::size_t>((dx + 1) + 3 * (dy + 1)) + m * ltarget + lsource;
+}
+
+std::string stateName(int dx, int dy, std::size_t level) {
+    return "s_" + std::to_string(dx + 1) + "_" + std::to_string(dy + 1) + "_" + std::to_string(level);
+}
+
+}
+
+
+std::size_t countRuleTaps(const std::vector<float>& rules, std::size_t m) {
+    myassert(rules.size() == 9 * m * m + m, "rules have wrong size");
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < 9 * m * m; ++i) {
+        if (rules[i] != 0.f) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+std::string generateAutomatonSource(const std::vector<float>& rules, std::size_t m, bool banded, bool vectorized) {
+    myassert(rules.size() == 9 * m * m + m, "rules have wrong size");
+    std::string value_type = vectorized ? "floatv" : "float";
+
+    std::ostringstream src;
+    src << embeddedKernelSources().at("state.cl") << "\n";
+    src << "// generated from the rule tensor at startup, do not edit\n";
+    src << "#pragma OPENCL FP_CONTRACT OFF\n\n";
+    src << "__kernel void automaton_specialized(__global const state_t* state_in, __global state_t* state_out) {\n";
+    if (vectorized) {
+        // STATE_VEC cells along x per work-item, the shifted neighbours come from state_vload_row
+        src << "    int x = get_global_id(0) * STATE_VEC;\n";
+        src << "    int y = get_global_id(1);\n";
+        src << "    int width = get_global_size(0) * STATE_VEC;\n";
+        src << "    int height = get_global_size(1);\n";
+    } else {
+        src << "    int x = get_global_id(0);\n";
+        src << "    int y = get_global_id(1);\n";
+        src << "    int width = get_global_size(0);\n";
+        src << "    int height = get_global_size(1);\n";
+        src << "    int state_x[3] = {(x + width - 1) % width, x, (x + 1) % width};\n";
+    }
+    if (banded) {
+        // rows 0 and height + 1 are the halo rows of the band
+        src << "    int state_y[3] = {y, y + 1, y + 2};\n";
+    } else {
+        src << "    int state_y[3] = {(y + height - 1) % height, y, (y + 1) % height};\n";
+    }
+    src << "    size_t row[3] = {(size_t)width * state_y[0], (size_t)width * state_y[1], (size_t)width * state_y[2]};\n";
+
+    // load every neighbour value that is used by at least one target level, once
+    for (int dx = -1; dx <= 1; ++dx) {
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (std::size_t lsource = 0; lsource < m; ++lsource) {
+                bool used = false;
+                for (std::size_t ltarget = 0; ltarget < m; ++ltarget) {
+                    used |= rules[ruleIndex(m, dx, dy, ltarget, lsource)] != 0.f;
+                }
+                if (used && vectorized) {
+                    src << "    floatv " << stateName(dx, dy, lsource) << " = state_vload_row(state_in, STATE_IDX(row[" << (dy + 1)
+                        << "], " << lsource << ", " << m << "), x, " << dx << ", width);\n";
+                } else if (used) {
+                    src << "    float " << stateName(dx, dy, lsource) << " = STATE_LOAD(state_in, STATE_IDX(state_x[" << (dx + 1)
+                        << "] + row[" << (dy + 1) << "], " << lsource << ", " << m << "));\n";
+                }
+            }
+        }
+    }
+
+    // same summation order as the generic kernel: bias, then dx, dy, source level
+    src << "    " << value_type << " sum;\n";
+    for (std::size_t ltarget = 0; ltarget < m; ++ltarget) {
+        src << "    sum = (" << value_type << ")(" << floatLiteral(rules[RIDX_BASE(m, ltarget)]) << ");\n";
+        for (int dx = -1; dx <= 1; ++dx) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (std::size_t lsource = 0; lsource < m; ++lsource) {
+                    float w = rules[ruleIndex(m, dx, dy, ltarget, lsource)];
+                    if (w != 0.f) {
+                        src << "    sum += " << stateName(dx, dy, lsource) << " * " << floatLiteral(w) << ";\n";
+                    }
+                }
+            }
+        }
+        if (vectorized) {
+            src << "    STATE_VSTORE(state_out, STATE_IDX(x + row[1], " << ltarget << ", " << m << "), max(min(sum, 1.f), 0.f));\n";
+        } else {
+            src << "    STATE_STORE(state_out, STATE_IDX(x + row[1], " << ltarget << ", " << m << "), max(0.f, min(sum, 1.f)));\n";
+        }
+    }
+    src << "}\n";
+
+    return src.str();
+}
+
+RuleSpecializer::RuleSpecializer(const cl::Context& context, const std::vector<cl::Device>& devices, std::size_t m, float dense_threshold, bool banded, bool vectorized, const std::string& options, const std::string& cache_dir)
+    : context(context),
+      devices(devices),
+      m(m),
+      dense_threshold(dense_threshold),
+      banded(banded),
+      vectorized(vectorized),
+      options(options),
+      cache_dir(cache_dir) {}
+
+bool RuleSpecializer::update(const std::vector<float>& rules) {
+    if (!current_rules.empty() && rules == current_rules) {
+        return false;
+    }
+    current_rules = rules;
+
+    ntaps = countRuleTaps(rules, m);
+    is_specialized = static_cast<float>(ntaps) <= dense_threshold * static_cast<float>(9 * m * m);
+    if (is_specialized) {
+        cl::Program program = buildProgramFromSource(generateAutomatonSource(rules, m, banded, vectorized), context, devices, options, cache_dir);
+        specialized_kernel = cl::Kernel(program, "automaton_specialized");
+    } else {
+        specialized_kernel = cl::Kernel();
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#include "rulegen.hpp"
+#include "scene.hpp"
+
+
+scene_t make_demo_scene(std::size_t n, std::size_t m) {
+    myassert(m >= 4, "demo scene needs m >= 4");
+
+    scene_t scene;
+    scene.state.resize(n * n * m, 0.f);
+    scene.rules.resize(9 * m * m + m, 0.f);
+    scene.frequencies.resize(m, 0.f);
+    scene.colors.resize(m * 4, 0.f);
+
+    scene.colors[0] = 1.f;
+    scene.colors[1] = 0.f;
+    scene.colors[2] = 0.f;
+    scene.colors[3] = 1.f;
+
+    scene.colors[4] = 0.f;
+    scene.colors[5] = 1.f;
+    scene.colors[6] = 0.f;
+    scene.colors[7] = 1.f;
+
+    scene.colors[8] = 0.2f;
+    scene.colors[9] = 0.f;
+    scene.colors[10] = 1.f;
+    scene.colors[11] = 1.f;
+
+    scene.colors[12] = 0.5f;
+    scene.colors[13] = 0.5f;
+    scene.colors[14] = 0.5f;
+    scene.colors[15] = 1.f;
+
+    scene.state[0] = 1.f;
+
+    // copy level 0 to down right
+    scene.rules[RIDX_OTHER(m, 0, -1, 0, 0)] = 0.001f;
+    scene.rules[RIDX_OTHER(m, -1, 0, 0, 0)] = 0.004f;
+    scene.rules[RIDX_OTHER(m, 0, 0, 0, 0)] = 1.f;
+
+    // if there is some level 1 in my neighborhood, wipe level 0
+    scene.rules[RIDX_OTHER(m, -1, -1, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, -1, 0, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, -1, 1, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 0, -1, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 0, 0, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 0, 1, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 1, -1, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 1, 0, 0, 1)] = -10.f;
+    scene.rules[RIDX_OTHER(m, 1, 1, 0, 1)] = -10.f;
+
+    // create level 1 dots if there is a bunch (sum>0.8) level 0 around
+    scene.rules[RIDX_OTHER(m, -1, -1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, -1, 0, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, -1, 1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 0, -1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 0, 0, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 0, 1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 1, -1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 1, 0, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 1, 1, 1, 0)] = 0.1f;
+    scene.rules[RIDX_OTHER(m, 0, 0, 1, 1)] = 100.f;
+    scene.rules[RIDX_BASE(m, 1)] = -0.8f;
+
+    // 1 -> 2 star
+    scene.rules[RIDX_OTHER(m, 0, 0, 2, 2)] = 1.f;
+    scene.rules[RIDX_OTHER(m, -1, -1, 2, 1)] = 0.002f;
+    scene.rules[RIDX_OTHER(m, 1, -1, 2, 1)] = 0.002f;
+    scene.rules[RIDX_OTHER(m, -1, 1, 2, 1)] = 0.002f;
+    scene.rules[RIDX_OTHER(m, 1, 1, 2, 1)] = 0.002f;
+
+    scene.frequencies[0] = 400.f;
+    scene.frequencies[1] = 200.f;
+    scene.frequencies[2] = 600.f;
+
+    return scene;
+}
@@ -0,0 +1,133 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include <fstream>
+
+#include "opencl.hpp"
+#include "snapshot.hpp"
+
+
+namespace {
+
+const char snapshotMagic[8] = {'s', '2', '0', '1', '5', 's', 'n', 'p'};
+constexpr std::uint32_t snapshotVersion = 1;
+
+// followed by the state, rules, frequencies and colors
+struct snapshot_header_t {
+    char magic[8];
+    std::uint32_t version;
+    float t;
+    std::uint64_t n;
+    std::uint64_t m;
+    std::uint64_t generations;
+    std::uint64_t rules;
+    std::uint64_t frequencies;
+    std::uint64_t colors;
+};
+static_assert(sizeof(snapshot_header_t) == 64, "snapshot header must keep the state 64 byte aligned");
+
+const snapshot_header_t& header(const unsigned char* data) {
+    return *reinterpret_cast<const snapshot_header_t*>(data);
+}
+
+void writeFloats(std::ofstream& file, const float* values, std::size_t count) {
+    file.write(reinterpret_cast<const char*>(values), static_cast<std::streamsize>(sizeof(float) * count));
+}
+
+}
+
+
+void writeSnapshot(const std::string& path, std::size_t n, std::size_t m, const float* state, const scene_t& scene, std::uint64_t generations, float t) {
+    snapshot_header_t h;
+    std::memcpy(h.magic, snapshotMagic, sizeof(h.magic));
+    h.version = snapshotVersion;
+    h.t = t;
+    h.n = n;
+    h.m = m;
+    h.generations = generations;
+    h.rules = scene.rules.size();
+    h.frequencies = scene.frequencies.size();
+    h.colors = scene.colors.size();
+
+    std::string tmp = tempPath(path);
+    {
+        std::ofstream file(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        myassert(file.good(), "cannot open " + tmp);
+        file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        writeFloats(file, state, n * n * m);
+        writeFloats(file, scene.rules.data(), scene.rules.size());
+        writeFloats(file, scene.frequencies.data(), scene.frequencies.size());
+        writeFloats(file, scene.colors.data(), scene.colors.size());
+        myassert(file.good(), "cannot write to " + tmp);
+    }
+    myassert(std::rename(tmp.c_str(), path.c_str()) == 0, "cannot replace " + path);
+}
+
+MappedSnapshot::MappedSnapshot(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    myassert(fd >= 0, "cannot open snapshot " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(snapshot_header_t)) {
+        close(fd);
+        throw MyException("not a snapshot: " + path);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    myassert(mapping != MAP_FAILED, "cannot map snapshot " + path);
+    data = static_cast<const unsigned char*>(mapping);
+    // the state is read front to back by the upload
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const snapshot_header_t& h = header(data);
+    std::size_t values = h.n * h.n * h.m + h.rules + h.frequencies + h.colors;
+    if (std::memcmp(h.magic, snapshotMagic, sizeof(h.magic)) != 0 || h.version != snapshotVersion || size != sizeof(snapshot_header_t) + sizeof(float) * values) {
+        munmap(mapping, size);
+        throw MyException("not a snapshot or from another version: " + path);
+    }
+    if (h.rules != 9 * h.m * h.m + h.m || h.frequencies != h.m || h.colors != 4 * h.m) {
+        munmap(mapping, size);
+        throw MyException("scene of snapshot does not match its m: " + path);
+    }
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    munmap(const_cast<unsigned char*>(data), size);
+}
+
+std::size_t MappedSnapshot::n() const {
+    return static_cast<std::size_t>(header(data).n);
+}
+
+std::size_t MappedSnapshot::m() const {
+    return static_cast<std::size_t>(header(data).m);
+}
+
+std::uint64_t MappedSnapshot::generations() const {
+    return header(data).generations;
+}
+
+float MappedSnapshot::t() const {
+    return header(data).t;
+}
+
+const float* MappedSnapshot::state() const {
+    return reinterpret_cast<const float*>(data + sizeof(snapshot_header_t));
+}
+
+scene_t MappedSnapshot::scene() const {
+    const snapshot_header_t& h = header(data);
+    const float* rules = state() + h.n * h.n * h.m;
+    const float* frequencies = rules + h.rules;
+    const float* colors = frequencies + h.frequencies;
+    scene_t scene;
+    scene.rules.assign(rules, rules + h.rules);
+    scene.frequencies.assign(frequencies, frequencies + h.frequencies);
+    scene.colors.assign(colors, colors + h.colors);
+    return scene;
+}
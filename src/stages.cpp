@@ -0,0 +1,143 @@
+#include "stages.hpp"
+
+
+void checkStageConfig(const config_t& config) {
+    myassert(is_power_of_2(config.m), "m must be power of 2");
+    myassert(is_power_of_2(config.reduction_size), "reduction_size must be power of 2");
+    myassert(is_power_of_2(config.nsamples), "nsamples must be power of 2");
+    myassert(config.render_group > 0 && config.nsamples % config.render_group == 0, "nsamples must be a multiple of render_group");
+    myassert(is_power_of_2(config.reduce_lanes), "reduce_lanes must be power of 2");
+    myassert((config.local_width == 0) == (config.local_height == 0), "local_width and local_height must be set together");
+    myassert(config.nsamples % reduce_local_samples == 0, "nsamples must be a multiple of reduce_local_samples");
+    myassert(config.render_chunk > 0 && config.render_chunk % config.reduction_size == 0, "render_chunk must be a positive multiple of reduction_size");
+    myassert(config.frames_in_flight > 0, "frames_in_flight must be positive");
+}
+
+void checkAudioWorkGroup(const cl::Kernel& kernel, const cl::Device& device, const config_t& config) {
+    // the audio stages fold reduce_local_samples samples or m levels times reduce_lanes per work-group
+    std::size_t limit = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    if (config.render_mode == render_mode_t::samples) {
+        myassert(limit >= reduce_local_samples * config.reduce_lanes, "reduce_lanes too large for device");
+    } else {
+        myassert(limit >= config.m * config.reduce_lanes, "m * reduce_lanes too large for device, lower reduce_lanes");
+    }
+}
+
+std::size_t renderChunkBlocks(const config_t& config, std::size_t cells) {
+    return std::min(config.render_chunk, cells + config.reduction_size - 1) / config.reduction_size;
+}
+
+std::size_t reduceGroups(const config_t& config, std::size_t cells) {
+    std::size_t items = config.render_mode == render_mode_t::samples ? renderChunkBlocks(config, cells) : cells;
+    return std::min(reduce_max_groups, (items + config.reduce_lanes - 1) / config.reduce_lanes);
+}
+
+void setVisualizeArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dColors, const config_t& config, std::size_t first) {
+    kernel.setArg(0, dState);
+    kernel.setArg(2, dColors);
+    kernel.setArg(3, static_cast<cl_uint>(config.m));
+    kernel.setArg(4, static_cast<cl_ulong>(first));
+}
+
+void setRenderArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dFrequencies, const cl::Buffer& dBuffer0, const config_t& config, std::size_t first, std::size_t cells) {
+    kernel.setArg(0, dState);
+    kernel.setArg(1, dFrequencies);
+    kernel.setArg(2, dBuffer0);
+    kernel.setArg(3, static_cast<cl_uint>(config.m));
+    kernel.setArg(5, static_cast<cl_uint>(config.nsamples / config.render_group));
+    kernel.setArg(6, static_cast<cl_uint>(config.sample_rate));
+    kernel.setArg(7, static_cast<cl_uint>(config.reduction_size));
+    kernel.setArg(9, static_cast<cl_ulong>(first + cells));
+    kernel.setArg(10, sizeof(cl_float) * config.nsamples, nullptr);
+}
+
+void setAmplitudesArgs(cl::Kernel& kernel, const cl::Buffer& dState, const cl::Buffer& dPartial, const config_t& config, std::size_t first, std::size_t cells) {
+    kernel.setArg(0, dState);
+    kernel.setArg(1, dPartial);
+    kernel.setArg(2, static_cast<cl_uint>(config.m));
+    kernel.setArg(3, static_cast<cl_ulong>(cells));
+    kernel.setArg(4, sizeof(cl_float) * config.m * config.reduce_lanes, nullptr);
+    kernel.setArg(5, static_cast<cl_ulong>(first));
+}
+
+void setReduceArgs(cl::Kernel& kernel, const config_t& config) {
+    kernel.setArg(2, static_cast<cl_uint>(config.nsamples));
+    kernel.setArg(6, sizeof(cl_float) * reduce_local_samples * config.reduce_lanes, nullptr);
+}
+
+void setSynthesizeArgs(cl::Kernel& kernel, const cl::Buffer& dPartial, const cl::Buffer& dFrequencies, const config_t& config, std::size_t ngroups) {
+    kernel.setArg(0, dPartial);
+    kernel.setArg(1, dFrequencies);
+    kernel.setArg(3, static_cast<cl_uint>(config.m));
+    kernel.setArg(4, static_cast<cl_uint>(ngroups));
+    kernel.setArg(6, static_cast<cl_uint>(config.sample_rate));
+    kernel.setArg(7, 1.f / static_cast<float>(config.n * config.n));
+    kernel.setArg(8, sizeof(cl_float) * config.m, nullptr);
+}
+
+bool enqueueRenderChunks(const cl::CommandQueue& queue, cl::Kernel& kernelRender, cl::Kernel& kernelReduce, const cl::Buffer& dBuffer0, const cl::Buffer& dBuffer1, const cl::Buffer& dSamples, const config_t& config, std::size_t first, std::size_t cells, std::size_t ngroups, std::size_t instances, float t, float norm, bool finish, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts_render, std::vector<cl::Event>& evts_reduce, std::vector<cl::Event>* readers) {
+    std::size_t chunk_blocks = renderChunkBlocks(config, cells);
+    std::size_t chunk_cells = chunk_blocks * config.reduction_size;
+    std::size_t nchunks = (cells + chunk_cells - 1) / chunk_cells;
+    bool direct = finish && nchunks == 1 && ngroups == 1;
+    kernelRender.setArg(4, t);
+    kernelReduce.setArg(0, dBuffer0);
+    kernelReduce.setArg(1, direct ? dSamples : dBuffer1);
+    kernelReduce.setArg(4, direct ? norm : 1.f);
+    for (std::size_t c = 0; c < nchunks; ++c) {
+        std::size_t offset = c * chunk_cells;
+        std::size_t nblocks = std::min(chunk_blocks, (cells - offset + config.reduction_size - 1) / config.reduction_size);
+
+        kernelRender.setArg(8, static_cast<cl_ulong>(first + offset));
+        evts_render.push_back(cl::Event());
+        queue.enqueueNDRangeKernel(kernelRender, cl::NullRange, cl::NDRange(nblocks, config.render_group, instances), cl::NDRange(1, config.render_group, 1), &wait, &evts_render.back());
+        if (readers) {
+            readers->push_back(evts_render.back());
+        }
+
+        kernelReduce.setArg(3, static_cast<cl_uint>(nblocks));
+        kernelReduce.setArg(5, static_cast<cl_uint>(c > 0));
+        wait = {evts_render.back()};
+        evts_reduce.push_back(cl::Event());
+        queue.enqueueNDRangeKernel(kernelReduce, cl::NullRange, cl::NDRange(config.nsamples, config.reduce_lanes * ngroups, instances), cl::NDRange(reduce_local_samples, config.reduce_lanes, 1), &wait, &evts_reduce.back());
+        // the next chunk overwrites dBuffer0
+        wait = {evts_reduce.back()};
+    }
+    return direct;
+}
+
+void enqueueReduceFinal(const cl::CommandQueue& queue, cl::Kernel& kernelReduce, const cl::Buffer& dBuffer1, const cl::Buffer& dSamples, const config_t& config, std::size_t ngroups, std::size_t instances, float norm, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts) {
+    kernelReduce.setArg(0, dBuffer1);
+    kernelReduce.setArg(1, dSamples);
+    kernelReduce.setArg(3, static_cast<cl_uint>(ngroups));
+    kernelReduce.setArg(4, norm);
+    kernelReduce.setArg(5, static_cast<cl_uint>(0));
+    evts.push_back(cl::Event());
+    queue.enqueueNDRangeKernel(kernelReduce, cl::NullRange, cl::NDRange(config.nsamples, config.reduce_lanes, instances), cl::NDRange(reduce_local_samples, config.reduce_lanes, 1), &wait, &evts.back());
+    wait = {evts.back()};
+}
+
+void enqueueAmplitudes(const cl::CommandQueue& queue, cl::Kernel& kernel, const config_t& config, std::size_t ngroups, std::size_t instances, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts, std::vector<cl::Event>* readers) {
+    evts.push_back(cl::Event());
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(config.m, config.reduce_lanes * ngroups, instances), cl::NDRange(config.m, config.reduce_lanes, 1), &wait, &evts.back());
+    if (readers) {
+        readers->push_back(evts.back());
+    }
+    wait = {evts.back()};
+}
+
+void enqueueSynthesize(const cl::CommandQueue& queue, cl::Kernel& kernel, const cl::Buffer& dSamples, const config_t& config, std::size_t instances, float t, std::vector<cl::Event>& wait, std::vector<cl::Event>& evts) {
+    kernel.setArg(2, dSamples);
+    kernel.setArg(5, t);
+    evts.push_back(cl::Event());
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(config.nsamples, config.generations_per_launch, instances), cl::NDRange(config.render_group, 1, 1), &wait, &evts.back());
+    wait = {evts.back()};
+}
+
+float getEventsTimeMS(const std::vector<cl::Event>& evts) {
+    float sum = 0.f;
+    for (const auto& evt : evts) {
+        sum += getEventTimeMS(evt);
+    }
+    return sum;
+}
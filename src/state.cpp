@@ -0,0 +1,189 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+
+#include "state.hpp"
+
+
+namespace {
+
+// IEEE 754 binary16, round to nearest even like vstore_half_rte
+std::uint16_t floatToHalf(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::uint32_t sign = (bits >> 16) & 0x8000u;
+    std::uint32_t exponent = (bits >> 23) & 0xffu;
+    std::uint32_t mantissa = bits & 0x7fffffu;
+
+    if (exponent == 0xffu) {
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+    }
+    if (exponent >= 127 + 16) {
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+    }
+    if (exponent < 127 - 25) {
+        return static_cast<std::uint16_t>(sign);
+    }
+
+    // shift the mantissa (with implicit bit) down to 10 bits, subnormals lose one more bit per exponent step
+    std::uint32_t shift = exponent < 127 - 14 ? 13 + (127 - 14 - exponent) : 13;
+    std::uint32_t base = exponent < 127 - 14 ? 0 : (exponent - 127 + 15) << 10;
+    std::uint32_t full = exponent < 127 - 14 ? (mantissa | 0x800000u) : mantissa;
+    std::uint32_t half = base | (full >> shift);
+    std::uint32_t rest = full & ((1u << shift) - 1);
+    std::uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1u))) {
+        ++half; // a carry into the exponent is still correct
+    }
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+float halfToFloat(std::uint16_t value) {
+    std::uint32_t sign = (static_cast<std::uint32_t>(value) & 0x8000u) << 16;
+    std::uint32_t exponent = (value >> 10) & 0x1fu;
+    std::uint32_t mantissa = value & 0x3ffu;
+
+    if (exponent == 0) {
+        float result = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -result : result;
+    }
+    std::uint32_t bits = exponent == 0x1fu
+        ? sign | 0x7f800000u | (mantissa << 13)
+        : sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+template <typename T>
+T floatToUnorm(float value) {
+    float scale = static_cast<float>(std::numeric_limits<T>::max());
+    return static_cast<T>(std::nearbyint(std::max(0.f, std::min(value, 1.f)) * scale));
+}
+
+template <typename T>
+float unormToFloat(T value) {
+    return static_cast<float>(value) * (1.f / static_cast<float>(std::numeric_limits<T>::max()));
+}
+
+template <typename T>
+void store(std::vector<unsigned char>& data, std::size_t i, T value) {
+    std::memcpy(data.data() + i * sizeof(T), &value, sizeof(T));
+}
+
+template <typename T>
+T load(const std::vector<unsigned char>& data, std::size_t i) {
+    T value;
+    std::memcpy(&value, data.data() + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+}
+
+
+std::size_t stateValueSize(state_format_t format) {
+    switch (format) {
+        case state_format_t::fp16:
+        case state_format_t::unorm16:
+            return 2;
+        case state_format_t::unorm8:
+            return 1;
+        default:
+            return 4;
+    }
+}
+
+std::string stateFormatOption(state_format_t format) {
+    switch (format) {
+        case state_format_t::fp16:
+            return "-DSTATE_FORMAT=1";
+        case state_format_t::unorm16:
+            return "-DSTATE_FORMAT=2";
+        case state_format_t::unorm8:
+            return "-DSTATE_FORMAT=3";
+        default:
+            return "-DSTATE_FORMAT=0";
+    }
+}
+
+std::vector<unsigned char> encodeState(const std::vector<float>& values, state_format_t format) {
+    std::vector<unsigned char> data(values.size() * stateValueSize(format));
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        switch (format) {
+            case state_format_t::fp16:
+                store(data, i, floatToHalf(values[i]));
+                break;
+            case state_format_t::unorm16:
+                store(data, i, floatToUnorm<std::uint16_t>(values[i]));
+                break;
+            case state_format_t::unorm8:
+                store(data, i, floatToUnorm<std::uint8_t>(values[i]));
+                break;
+            default:
+                store(data, i, values[i]);
+        }
+    }
+    return data;
+}
+
+std::vector<float> decodeState(const std::vector<unsigned char>& data, state_format_t format) {
+    std::vector<float> values(data.size() / stateValueSize(format));
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        switch (format) {
+            case state_format_t::fp16:
+                values[i] = halfToFloat(load<std::uint16_t>(data, i));
+                break;
+            case state_format_t::unorm16:
+                values[i] = unormToFloat(load<std::uint16_t>(data, i));
+                break;
+            case state_format_t::unorm8:
+                values[i] = unormToFloat(load<std::uint8_t>(data, i));
+                break;
+            default:
+                values[i] = load<float>(data, i);
+        }
+    }
+    return values;
+}
+
+std::string stateLayoutOption(state_layout_t layout, std::size_t cells, std::size_t vector) {
+    if (layout != state_layout_t::planar) {
+        return "";
+    }
+    std::string option = " -DSTATE_PLANE=" + std::to_string(cells);
+    if (vector > 1) {
+        option += " -DSTATE_VEC=" + std::to_string(vector);
+    }
+    return option;
+}
+
+std::vector<float> toStateLayout(const std::vector<float>& values, std::size_t m, state_layout_t layout) {
+    if (layout != state_layout_t::planar) {
+        return values;
+    }
+    std::size_t cells = values.size() / m;
+    std::vector<float> planes(values.size());
+    for (std::size_t cell = 0; cell < cells; ++cell) {
+        for (std::size_t level = 0; level < m; ++level) {
+            planes[level * cells + cell] = values[cell * m + level];
+        }
+    }
+    return planes;
+}
+
+std::vector<float> fromStateLayout(const std::vector<float>& values, std::size_t m, state_layout_t layout) {
+    if (layout != state_layout_t::planar) {
+        return values;
+    }
+    std::size_t cells = values.size() / m;
+    std::vector<float> interleaved(values.size());
+    for (std::size_t cell = 0; cell < cells; ++cell) {
+        for (std::size_t level = 0; level < m; ++level) {
+            interleaved[cell * m + level] = values[level * cells + cell];
+        }
+    }
+    return interleaved;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+
+ThreadPool::ThreadPool(std::size_t threads) {
+    if (threads == 0) {
+        threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+    for (std::size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv_start.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::dispatch(std::size_t count, invoke_t invoke, void* context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->invoke = invoke;
+        this->context = context;
+        this->count = count;
+        next.store(0, std::memory_order_relaxed);
+        busy = workers.size();
+        error = nullptr;
+        ++generation;
+    }
+    cv_start.notify_all();
+    work();
+
+    // every worker has to check in, so none of them can still be looking at this generation once the next one starts
+    std::unique_lock<std::mutex> lock(mutex);
+    cv_done.wait(lock, [&] { return busy == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::loop() {
+    std::size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_start.wait(lock, [&] { return generation != seen || stopping; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        work();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy;
+        }
+        cv_done.notify_one();
+    }
+}
+
+void ThreadPool::work() {
+    // invoke, context and count are written before the generation is published under the mutex
+    std::size_t i;
+    while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+        try {
+            invoke(context, i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#include <fstream>
+#include <iostream>
+
+#include "tool.hpp"
+
+
+void split_tool_options(const std::string& name, const tool_options_t& options, int argc, char** argv, std::vector<char*>& rest) {
+    rest.push_back(argv[0]);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "--help") {
+            std::cout << name << " keys:";
+            for (const auto& kv : options) {
+                std::cout << " " << kv.first;
+            }
+            std::cout << std::endl;
+        }
+        auto eq = arg.find('=');
+        auto it = (arg.compare(0, 2, "--") == 0 && eq != std::string::npos) ? options.find(arg.substr(2, eq - 2)) : options.end();
+        if (it != options.end()) {
+            it->second(arg.substr(eq + 1));
+        } else {
+            rest.push_back(argv[i]);
+        }
+    }
+}
+
+std::vector<cl::Platform> tool_platforms() {
+    std::vector<cl::Platform> platforms;
+    try {
+        cl::Platform::get(&platforms);
+    } catch (const cl::Error&) {
+        // no ICD at all, the callers decide whether they need one
+    }
+    return platforms;
+}
+
+std::vector<cl::Device> tool_devices(const std::vector<cl::Platform>& platforms, std::size_t platform, std::size_t device) {
+    myassert(platform < platforms.size(), "platform not found");
+    std::vector<cl::Device> devices;
+    platforms[platform].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+    myassert(device < devices.size(), "device not found");
+    return std::vector<cl::Device>(devices.begin() + static_cast<std::ptrdiff_t>(device), devices.end());
+}
+
+void write_ppm(const std::string& path, const unsigned char* rgba, std::size_t n) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    myassert(file.good(), "cannot open " + path);
+    file << "P6\n" << n << " " << n << "\n255\n";
+    std::vector<char> rgb(3 * n * n);
+    for (std::size_t i = 0; i < n * n; ++i) {
+        rgb[3 * i] = static_cast<char>(rgba[4 * i]);
+        rgb[3 * i + 1] = static_cast<char>(rgba[4 * i + 1]);
+        rgb[3 * i + 2] = static_cast<char>(rgba[4 * i + 2]);
+    }
+    file.write(rgb.data(), static_cast<std::streamsize>(rgb.size()));
+    myassert(file.good(), "cannot write to " + path);
+}
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.hpp"
+
+
+namespace {
+
+enum class trace_kind_t : std::uint8_t {
+    span,
+    counter
+};
+
+struct trace_event_t {
+    const char* name;
+    std::uint64_t start;
+    std::uint64_t end;
+    double value;
+    std::uint32_t track;
+    trace_kind_t kind;
+};
+
+// written by its thread only, `count` publishes the events to `traceDump`
+struct trace_buffer_t {
+    std::unique_ptr<trace_event_t[]> events;
+    std::size_t capacity = 0;
+    std::atomic<std::size_t> count{0};
+    std::atomic<std::size_t> dropped{0};
+    std::uint32_t tid = 0;
+    std::string name;
+};
+
+std::atomic<bool> trace_enabled{false};
+std::size_t trace_capacity = 0;
+std::chrono::steady_clock::time_point trace_start;
+
+// the buffers live until the end of the program, so a dump can still read those of finished threads
+std::mutex trace_mutex;
+std::vector<std::unique_ptr<trace_buffer_t>> trace_buffers;
+std::vector<std::string> trace_tracks;
+
+thread_local trace_buffer_t* trace_local = nullptr;
+
+trace_buffer_t* localBuffer() {
+    if (!trace_local) {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        std::unique_ptr<trace_buffer_t> buffer(new trace_buffer_t);
+        buffer->events.reset(new trace_event_t[trace_capacity]);
+        buffer->capacity = trace_capacity;
+        buffer->tid = static_cast<std::uint32_t>(trace_buffers.size() + 1);
+        buffer->name = "thread " + std::to_string(buffer->tid);
+        trace_local = buffer.get();
+        trace_buffers.push_back(std::move(buffer));
+    }
+    return trace_local;
+}
+
+void record(const trace_event_t& event) {
+    trace_buffer_t* buffer = localBuffer();
+    std::size_t i = buffer->count.load(std::memory_order_relaxed);
+    if (i >= buffer->capacity) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[i] = event;
+    buffer->count.store(i + 1, std::memory_order_release);
+}
+
+std::string escape(const std::string& s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        if (c != '\0') {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// the trace format wants microseconds
+double toUs(std::uint64_t ns) {
+    return static_cast<double>(ns) / 1000.;
+}
+
+}
+
+
+void traceEnable(std::size_t capacity) {
+    myassert(capacity > 0, "trace capacity must be positive");
+    trace_capacity = capacity;
+    trace_start = std::chrono::steady_clock::now();
+    trace_enabled.store(true, std::memory_order_release);
+}
+
+bool traceEnabled() {
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+std::uint64_t traceNow() {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_start).count());
+}
+
+void traceThreadName(const std::string& name) {
+    if (traceEnabled()) {
+        trace_buffer_t* buffer = localBuffer();
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        buffer->name = name;
+    }
+}
+
+std::uint32_t traceTrack(const std::string& name) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_tracks.push_back(name);
+    return static_cast<std::uint32_t>(trace_tracks.size());
+}
+
+void traceSpan(const char* name, std::uint64_t start, std::uint64_t end, std::uint32_t track) {
+    if (traceEnabled()) {
+        record({name, start, std::max(start, end), 0., track, trace_kind_t::span});
+    }
+}
+
+void traceCounter(const char* name, double value) {
+    if (traceEnabled()) {
+        std::uint64_t now = traceNow();
+        record({name, now, now, value, 0, trace_kind_t::counter});
+    }
+}
+
+void traceDump(const std::string& path) {
+    std::ofstream out(path, std::ios::trunc);
+    myassert(out.good(), "cannot open " + path);
+    // timestamps grow large, scientific notation would cut them to six digits
+    out << std::fixed << std::setprecision(3);
+
+    // threads are in process 1, the extra tracks (devices) in process 2
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out << "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"args\": {\"name\": \"host\"}}";
+    out << ",\n{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 2, \"args\": {\"name\": \"devices\"}}";
+    for (std::size_t i = 0; i < trace_tracks.size(); ++i) {
+        out << ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 2, \"tid\": " << i + 1 << ", \"args\": {\"name\": \"" << escape(trace_tracks[i]) << "\"}}";
+    }
+    std::size_t dropped = 0;
+    for (const auto& buffer : trace_buffers) {
+        out << ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"args\": {\"name\": \"" << escape(buffer->name) << "\"}}";
+        std::size_t count = buffer->count.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i) {
+            const trace_event_t& event = buffer->events[i];
+            if (event.kind == trace_kind_t::counter) {
+                out << ",\n{\"ph\": \"C\", \"name\": \"" << event.name << "\", \"pid\": 1, \"ts\": " << toUs(event.start) << ", \"args\": {\"value\": " << event.value << "}}";
+            } else if (event.track > 0) {
+                out << ",\n{\"ph\": \"X\", \"name\": \"" << event.name << "\", \"pid\": 2, \"tid\": " << event.track << ", \"ts\": " << toUs(event.start) << ", \"dur\": " << toUs(event.end - event.start) << "}";
+            } else {
+                out << ",\n{\"ph\": \"X\", \"name\": \"" << event.name << "\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": " << toUs(event.start) << ", \"dur\": " << toUs(event.end - event.start) << "}";
+            }
+        }
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    out << "\n], \"otherData\": {\"dropped_events\": " << dropped << "}}" << std::endl;
+    myassert(out.good(), "cannot write to " + path);
+}
@@ -0,0 +1,363 @@
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "pipeline.hpp"
+#include "scene.hpp"
+#include "tuning.hpp"
+
+
+namespace {
+
+// exclusive advisory lock on `path`, held until destruction
+class FileLock {
+    public:
+        FileLock(const std::string& path) : fd(open(path.c_str(), O_RDWR | O_CREAT, 0644)) {
+            myassert(fd >= 0 && flock(fd, LOCK_EX) == 0, "cannot lock " + path);
+        }
+        ~FileLock() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        FileLock(const FileLock&) = delete;
+        FileLock& operator=(const FileLock&) = delete;
+
+    private:
+        int fd;
+};
+
+// one launch parameter, the options of its current value and of every value to try
+struct parameter_t {
+    std::string name;
+    std::vector<std::string> current;
+    std::vector<std::vector<std::string>> candidates;
+};
+
+std::string option(const std::string& key, std::size_t value) {
+    return "--" + key + "=" + std::to_string(value);
+}
+
+// limits every candidate must stay within, the smallest of all devices
+struct limits_t {
+    std::size_t group = std::numeric_limits<std::size_t>::max();
+    std::size_t x = std::numeric_limits<std::size_t>::max();
+    std::size_t y = std::numeric_limits<std::size_t>::max();
+    std::size_t local_mem = std::numeric_limits<std::size_t>::max();
+
+    bool fits(std::size_t width, std::size_t height, std::size_t local_bytes) const {
+        return width * height <= group && width <= x && height <= y && local_bytes <= local_mem;
+    }
+};
+
+limits_t deviceLimits(const std::vector<cl::Device>& devices) {
+    limits_t limits;
+    for (const auto& device : devices) {
+        limits.group = std::min(limits.group, static_cast<std::size_t>(device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>()));
+        std::vector<std::size_t> sizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+        if (sizes.size() >= 2) {
+            limits.x = std::min(limits.x, sizes[0]);
+            limits.y = std::min(limits.y, sizes[1]);
+        }
+        limits.local_mem = std::min(limits.local_mem, static_cast<std::size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()));
+    }
+    return limits;
+}
+
+// the candidates for the current config, the shapes that cannot launch on the devices are left out
+std::vector<parameter_t> launchParameters(const config_t& config, const limits_t& limits) {
+    std::vector<parameter_t> parameters;
+    std::size_t m = config.m;
+    bool temporal = config.generations_per_launch > 1;
+    bool fused = !temporal && config.automaton_kernel == automaton_kernel_t::fused;
+    bool tiled = temporal || fused || config.automaton_kernel == automaton_kernel_t::tiled || config.automaton_kernel == automaton_kernel_t::sparse;
+
+    if (tiled) {
+        parameter_t tile = {"automaton_tile", {option("automaton-tile", config.automaton_tile)}, {}};
+        for (std::size_t t : {4u, 8u, 16u, 32u}) {
+            config_t trial = config;
+            trial.automaton_tile = t;
+            if (limits.fits(t, t, Pipeline::automaton_local_bytes(trial))) {
+                tile.candidates.push_back({option("automaton-tile", t)});
+            }
+        }
+        parameters.push_back(tile);
+    }
+    if (!fused) {
+        // the untiled automaton kernels and visualize
+        parameter_t local = {"local_size", {option("local-width", config.local_width), option("local-height", config.local_height)}, {}};
+        const std::size_t shapes[][2] = {{0, 0}, {8, 8}, {16, 4}, {16, 16}, {32, 4}, {32, 8}, {64, 1}, {64, 4}, {128, 1}, {256, 1}};
+        for (const auto& shape : shapes) {
+            if (limits.fits(shape[0], shape[1], 0)) {
+                local.candidates.push_back({option("local-width", shape[0]), option("local-height", shape[1])});
+            }
+        }
+        parameters.push_back(local);
+    }
+
+    parameter_t render = {"render_group", {option("render-group", config.render_group)}, {}};
+    for (std::size_t g : {8u, 16u, 32u, 64u, 128u, 256u}) {
+        if (limits.fits(g, 1, 0) && limits.fits(1, g, sizeof(float) * config.nsamples)) {
+            render.candidates.push_back({option("render-group", g)});
+        }
+    }
+    parameters.push_back(render);
+
+    parameter_t lanes = {"reduce_lanes", {option("reduce-lanes", config.reduce_lanes)}, {}};
+    for (std::size_t l : {8u, 16u, 32u, 64u, 128u}) {
+        // reduce folds 4 samples per work-group, amplitudes all levels
+        if (limits.fits(4, l, sizeof(float) * 4 * l) && (config.render_mode == render_mode_t::samples || limits.fits(m, l, sizeof(float) * m * l))) {
+            lanes.candidates.push_back({option("reduce-lanes", l)});
+        }
+    }
+    parameters.push_back(lanes);
+
+    if (config.render_mode == render_mode_t::samples) {
+        parameter_t reduction = {"reduction_size", {option("reduction-size", config.reduction_size)}, {}};
+        for (std::size_t r : {4u, 8u, 16u, 32u, 64u}) {
+            reduction.candidates.push_back({option("reduction-size", r)});
+        }
+        parameters.push_back(reduction);
+    }
+    return parameters;
+}
+
+// why `config` cannot launch on the devices, empty if it can: the constraints the Pipeline asserts on the tuned options
+std::string launchProblem(const config_t& config, const limits_t& limits) {
+    std::size_t n = config.n;
+    std::size_t vector_cells = config.state_layout == state_layout_t::planar ? config.state_vector : 1;
+    std::size_t local_bytes = Pipeline::automaton_local_bytes(config);
+    if (local_bytes > 0) {
+        if (config.automaton_tile == 0 || n % config.automaton_tile != 0) {
+            return "n is not a multiple of automaton_tile";
+        }
+        if (!limits.fits(config.automaton_tile, config.automaton_tile, local_bytes)) {
+            return "automaton_tile exceeds the device limits";
+        }
+    }
+    if (config.local_width > 0) {
+        if (vector_cells == 0 || n % vector_cells != 0 || (n / vector_cells) % config.local_width != 0) {
+            return "n / state_vector is not a multiple of local_width";
+        }
+        for (std::size_t rows : Pipeline::band_rows(config)) {
+            if (config.local_height == 0 || rows % config.local_height != 0) {
+                return "the rows of a band are not a multiple of local_height";
+            }
+        }
+        if (!limits.fits(config.local_width, config.local_height, 0)) {
+            return "local_width * local_height exceeds the device limits";
+        }
+    }
+    if (config.render_group == 0 || config.nsamples % config.render_group != 0 || !limits.fits(1, config.render_group, sizeof(float) * config.nsamples)) {
+        return "render_group does not fit nsamples or the device limits";
+    }
+    if (!limits.fits(4, config.reduce_lanes, sizeof(float) * 4 * config.reduce_lanes) || (config.render_mode == render_mode_t::levels && !limits.fits(config.m, config.reduce_lanes, sizeof(float) * config.m * config.reduce_lanes))) {
+        return "reduce_lanes exceeds the device limits";
+    }
+    if (config.reduction_size == 0 || config.render_chunk % config.reduction_size != 0) {
+        return "render_chunk is not a multiple of reduction_size";
+    }
+    return "";
+}
+
+// median device time of all compute stages per frame, infinite if the candidate does not run on the devices
+float measure(const config_t& config, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, const scene_t& scene, std::size_t warmup, std::size_t frames) {
+    try {
+        auto hTexture = std::make_shared<TripleBuffer<texture_view_t>>();
+        auto audiobuffer = std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(config), config.nsamples);
+        Pipeline pipeline(config, context, devices, log, scene.state.data(), scene.rules, scene.frequencies, scene.colors, hTexture, audiobuffer);
+
+        std::vector<float> times;
+        times.reserve(frames);
+        std::size_t retired = 0;
+        pipeline.set_stats_callback([&](const frame_stats_t& s) {
+            if (retired++ >= warmup && times.size() < frames) {
+                times.push_back(s.automaton + s.visualize + s.halo + s.render + s.reduce);
+            }
+        });
+        while (times.size() < frames) {
+            pipeline.poll();
+            while (audiobuffer->read_block()) {
+                audiobuffer->commit_read();
+            }
+        }
+        pipeline.drain();
+
+        std::nth_element(times.begin(), times.begin() + static_cast<std::ptrdiff_t>(times.size() / 2), times.end());
+        return times[times.size() / 2];
+    } catch (const cl::Error& e) {
+        log->info() << "candidate failed: " << e.what() << " (" << e.err() << ")";
+    } catch (const MyException& e) {
+        log->info() << "candidate rejected: " << e.what();
+    }
+    return std::numeric_limits<float>::infinity();
+}
+
+}
+
+
+std::string tuningKey(const config_t& config, const std::vector<cl::Device>& devices) {
+    // everything that changes the kernels or the constraints on their launch shapes
+    static const char* kernels[] = {"generic", "tiled", "specialized", "sparse", "fused"};
+    static const char* queue_modes[] = {"in-order", "out-of-order", "split"};
+    static const char* output_memories[] = {"copy", "alloc-host-ptr", "use-host-ptr"};
+    static const char* state_formats[] = {"fp32", "fp16", "unorm16", "unorm8"};
+    std::ostringstream key;
+    key << devices.front().getInfo<CL_DEVICE_NAME>() << " / " << devices.front().getInfo<CL_DRIVER_VERSION>();
+    key << " / n=" << config.n << " m=" << config.m << " nsamples=" << config.nsamples << " bands=" << config.bands;
+    key << " render_mode=" << (config.render_mode == render_mode_t::samples ? "samples" : "levels");
+    key << " automaton_kernel=" << kernels[static_cast<std::size_t>(config.automaton_kernel)];
+    key << " generations_per_launch=" << config.generations_per_launch;
+    key << " state_format=" << state_formats[static_cast<std::size_t>(config.state_format)];
+    key << " state_layout=" << (config.state_layout == state_layout_t::interleaved ? "interleaved" : "planar");
+    if (config.state_layout == state_layout_t::planar) {
+        key << " state_vector=" << config.state_vector;
+    }
+    key << " queue_mode=" << queue_modes[static_cast<std::size_t>(config.queue_mode)];
+    key << " output_memory=" << output_memories[static_cast<std::size_t>(config.output_memory)];
+    return key.str();
+}
+
+// file layout: one profile per line, the key and the options separated by tabs
+std::vector<std::string> loadTuningProfile(const std::string& path, const std::string& key) {
+    std::ifstream file(path.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string field;
+        if (!std::getline(fields, field, '\t') || field != key) {
+            continue;
+        }
+        std::vector<std::string> options;
+        while (std::getline(fields, field, '\t')) {
+            options.push_back(field);
+        }
+        return options;
+    }
+    return {};
+}
+
+void storeTuningProfile(const std::string& path, const std::string& key, const std::vector<std::string>& options) {
+    std::size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        makeDirectories(path.substr(0, slash));
+    }
+    // concurrent tuning runs take turns, so none of them drops the profile another one stored meanwhile
+    FileLock lock(path + ".lock");
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path.c_str());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, key.size() + 1, key + '\t') != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+    std::string line = key;
+    for (const auto& o : options) {
+        line += '\t' + o;
+    }
+    lines.push_back(line);
+
+    // write to a temporary file first, so a concurrent start never reads half a profile
+    std::string tmp = tempPath(path);
+    {
+        std::ofstream file(tmp.c_str(), std::ios::trunc);
+        for (const auto& l : lines) {
+            file << l << "\n";
+        }
+        myassert(file.good(), "cannot write " + tmp);
+    }
+    myassert(std::rename(tmp.c_str(), path.c_str()) == 0, "cannot replace " + path);
+}
+
+config_t applyTuningProfile(const config_t& config, const std::vector<cl::Device>& devices, int argc, char** argv, const std::shared_ptr<spdlog::logger>& log) {
+    if (config.tuning_file.empty() || devices.empty()) {
+        return config;
+    }
+    std::string key = tuningKey(config, devices);
+    std::vector<std::string> options = loadTuningProfile(config.tuning_file, key);
+    if (options.empty()) {
+        log->info() << "no launch profile for " << key << ", run s2015bench --tune=1 to create one";
+        return config;
+    }
+
+    config_t tuned = config;
+    std::string applied;
+    try {
+        for (const auto& o : options) {
+            set_config_option(tuned, o);
+            applied += " " + o;
+        }
+    } catch (const MyException& e) {
+        log->warn() << "ignore the launch profile for " << key << ": " << e.what();
+        return config;
+    }
+    for (int i = 1; i < argc; ++i) {
+        set_config_option(tuned, argv[i]);
+    }
+    // a profile from an older version or edited by hand may not fit anymore, running without it beats aborting
+    std::string problem = launchProblem(tuned, deviceLimits(devices));
+    if (!problem.empty()) {
+        log->warn() << "ignore the launch profile for " << key << ": " << problem;
+        return config;
+    }
+    log->info() << "launch profile:" << applied;
+    return tuned;
+}
+
+std::vector<std::string> tuneLaunchConfig(const config_t& config, const cl::Context& context, const std::vector<cl::Device>& devices, const std::shared_ptr<spdlog::logger>& log, std::size_t warmup, std::size_t frames) {
+    myassert(config.backend == backend_t::opencl && !devices.empty(), "tuning requires the OpenCL backend");
+    myassert(frames > 0, "tuning requires frames");
+    scene_t scene = make_demo_scene(config.n, config.m);
+
+    // coordinate descent: every parameter gets the value that was fastest with the best ones of the parameters before
+    std::vector<parameter_t> parameters = launchParameters(config, deviceLimits(devices));
+    std::map<std::string, std::vector<std::string>> chosen;
+    for (const auto& parameter : parameters) {
+        chosen[parameter.name] = parameter.current;
+    }
+    float best_time = measure(config, context, devices, log, scene, warmup, frames);
+    log->info() << "tune from " << best_time << " ms per frame";
+    for (const auto& parameter : parameters) {
+        for (const auto& candidate : parameter.candidates) {
+            if (candidate == parameter.current) {
+                continue;
+            }
+            config_t trial = config;
+            for (const auto& kv : chosen) {
+                for (const auto& o : kv.second) {
+                    set_config_option(trial, o);
+                }
+            }
+            std::string description;
+            for (const auto& o : candidate) {
+                set_config_option(trial, o);
+                description += " " + o;
+            }
+            float time = measure(trial, context, devices, log, scene, warmup, frames);
+            log->info() << parameter.name << ":" << description << " takes " << time << " ms per frame";
+            if (time < best_time) {
+                best_time = time;
+                chosen[parameter.name] = candidate;
+            }
+        }
+    }
+    log->info() << "tuned to " << best_time << " ms per frame";
+
+    std::vector<std::string> options;
+    for (const auto& kv : chosen) {
+        options.insert(options.end(), kv.second.begin(), kv.second.end());
+    }
+    return options;
+}
@@ -0,0 +1,54 @@
+#include <cstdint>
+
+#include "wav.hpp"
+
+
+namespace {
+
+template <typename T>
+void write_le(std::ofstream& file, T value) {
+    for (std::size_t i = 0; i < sizeof(T); ++i) {
+        file.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+}
+
+
+WavWriter::WavWriter(const std::string& path, std::size_t sample_rate)
+    : path(path),
+      file(path, std::ios::binary | std::ios::trunc),
+      sample_rate(sample_rate) {
+    myassert(file.good(), "cannot open " + path);
+    write_header();
+}
+
+WavWriter::~WavWriter() {
+    // fill in the sizes, the file is complete even if the program stops here
+    file.seekp(0);
+    write_header();
+    file.close();
+}
+
+void WavWriter::write(const float* data, std::size_t count) {
+    file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(sizeof(float) * count));
+    myassert(file.good(), "cannot write to " + path);
+    data_bytes += sizeof(float) * count;
+}
+
+void WavWriter::write_header() {
+    // RIFF with a fmt chunk for mono IEEE float (format 3) and the data chunk, little endian
+    std::uint32_t rate = static_cast<std::uint32_t>(sample_rate);
+    file.write("RIFF", 4);
+    write_le<std::uint32_t>(file, static_cast<std::uint32_t>(36 + data_bytes));
+    file.write("WAVEfmt ", 8);
+    write_le<std::uint32_t>(file, 16);
+    write_le<std::uint16_t>(file, 3);
+    write_le<std::uint16_t>(file, 1);
+    write_le<std::uint32_t>(file, rate);
+    write_le<std::uint32_t>(file, rate * static_cast<std::uint32_t>(sizeof(float)));
+    write_le<std::uint16_t>(file, static_cast<std::uint16_t>(sizeof(float)));
+    write_le<std::uint16_t>(file, static_cast<std::uint16_t>(8 * sizeof(float)));
+    file.write("data", 4);
+    write_le<std::uint32_t>(file, static_cast<std::uint32_t>(data_bytes));
+}
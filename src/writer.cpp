@@ -0,0 +1,77 @@
+#include "writer.hpp"
+
+
+BackgroundWriter::BackgroundWriter(std::size_t capacity)
+    : capacity(capacity),
+      thread(&BackgroundWriter::loop, this) {}
+
+BackgroundWriter::~BackgroundWriter() {
+    try {
+        finish();
+    } catch (...) {
+        // reported by an explicit finish() only
+    }
+}
+
+void BackgroundWriter::post(std::size_t bytes, std::function<void()> task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    myassert(!stopping, "writer already finished");
+    if (queued > 0 && queued + bytes > capacity) {
+        ++stall_count;
+        cv_space.wait(lock, [&] { return queued == 0 || queued + bytes <= capacity; });
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    tasks.emplace_back(bytes, std::move(task));
+    queued += bytes;
+    cv_tasks.notify_one();
+}
+
+void BackgroundWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv_tasks.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void BackgroundWriter::loop() {
+    while (true) {
+        std::pair<std::size_t, std::function<void()>> task;
+        bool failed;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv_tasks.wait(lock, [&] { return !tasks.empty() || stopping; });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            failed = static_cast<bool>(error);
+        }
+
+        // after an error, the remaining tasks are dropped
+        if (!failed) {
+            try {
+                task.second();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+            }
+        }
+        task.second = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued -= task.first;
+        }
+        cv_space.notify_one();
+    }
+}
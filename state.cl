@@ -0,0 +1,85 @@
+// storage format of the automaton state, prepended to every program. All values are in [0, 1], arithmetic is always
+// done in float, only loads and stores convert. STATE_FORMAT: 0 = fp32, 1 = fp16, 2 = 16 bit unorm, 3 = 8 bit unorm.
+#ifndef STATE_FORMAT
+#define STATE_FORMAT 0
+#endif
+
+#if STATE_FORMAT == 1
+typedef half state_t;
+#define STATE_LOAD(p, i) vload_half((i), (p))
+#define STATE_STORE(p, i, v) vstore_half_rte((v), (i), (p))
+#elif STATE_FORMAT == 2
+typedef ushort state_t;
+#define STATE_LOAD(p, i) ((float)((p)[i]) * (1.f / 65535.f))
+#define STATE_STORE(p, i, v) ((p)[i] = convert_ushort_sat_rte((v) * 65535.f))
+#elif STATE_FORMAT == 3
+typedef uchar state_t;
+#define STATE_LOAD(p, i) ((float)((p)[i]) * (1.f / 255.f))
+#define STATE_STORE(p, i, v) ((p)[i] = convert_uchar_sat_rte((v) * 255.f))
+#else
+typedef float state_t;
+#define STATE_LOAD(p, i) ((p)[i])
+#define STATE_STORE(p, i, v) ((p)[i] = (v))
+#endif
+
+// layout of the state, `cell` counts along the rows. By default the levels of a cell are interleaved, with STATE_PLANE
+// (the number of cells of the buffer) defined every level is a contiguous plane.
+#ifdef STATE_PLANE
+#define STATE_IDX(cell, level, m) ((size_t)(level) * (size_t)(STATE_PLANE) + (size_t)(cell))
+#else
+#define STATE_IDX(cell, level, m) ((size_t)(cell) * (size_t)(m) + (size_t)(level))
+#endif
+
+// with INSTANCES > 1, every buffer holds that many independent automata one after the other, each a whole grid of
+// INSTANCE_CELLS cells with its own rules and frequencies (see Ensemble). The kernels take the instance from dimension 2
+// of the NDRange, which is 0 for the launches of a single automaton.
+#ifndef INSTANCES
+#define INSTANCES 1
+#define INSTANCE_CELLS 0
+#endif
+#define INSTANCE_STATE(instance, m) ((size_t)(instance) * (size_t)(INSTANCE_CELLS) * (size_t)(m))
+
+// in the planar layout, STATE_VEC (4 or 8) neighbouring cells of one level can be loaded and stored as one vector of
+// type floatv, starting at any index
+#if defined(STATE_PLANE) && defined(STATE_VEC)
+#define STATE_CAT_(a, b) a##b
+#define STATE_CAT(a, b) STATE_CAT_(a, b)
+#define floatv STATE_CAT(float, STATE_VEC)
+
+#if STATE_FORMAT == 1
+#define STATE_VLOAD(p, i) STATE_CAT(vload_half, STATE_VEC)(0, (p) + (i))
+#define STATE_VSTORE(p, i, v) STATE_CAT(STATE_CAT(vstore_half, STATE_VEC), _rte)((v), 0, (p) + (i))
+#elif STATE_FORMAT == 2
+#define STATE_VLOAD(p, i) (STATE_CAT(convert_float, STATE_VEC)(STATE_CAT(vload, STATE_VEC)(0, (p) + (i))) * (1.f / 65535.f))
+#define STATE_VSTORE(p, i, v) STATE_CAT(vstore, STATE_VEC)(STATE_CAT(STATE_CAT(convert_ushort, STATE_VEC), _sat_rte)((v) * 65535.f), 0, (p) + (i))
+#elif STATE_FORMAT == 3
+#define STATE_VLOAD(p, i) (STATE_CAT(convert_float, STATE_VEC)(STATE_CAT(vload, STATE_VEC)(0, (p) + (i))) * (1.f / 255.f))
+#define STATE_VSTORE(p, i, v) STATE_CAT(vstore, STATE_VEC)(STATE_CAT(STATE_CAT(convert_uchar, STATE_VEC), _sat_rte)((v) * 255.f), 0, (p) + (i))
+#else
+#define STATE_VLOAD(p, i) STATE_CAT(vload, STATE_VEC)(0, (p) + (i))
+#define STATE_VSTORE(p, i, v) STATE_CAT(vstore, STATE_VEC)((v), 0, (p) + (i))
+#endif
+
+// the values of the cells x + dx .. x + dx + STATE_VEC - 1 (dx in -1, 0, 1) of the row starting at `row`, wrapping
+// around at `width`. Only the value that crosses the vector boundary needs a scalar load.
+floatv state_vload_row(__global const state_t* state, size_t row, int x, int dx, int width) {
+    floatv center = STATE_VLOAD(state, row + x);
+    if (dx < 0) {
+        float left = STATE_LOAD(state, row + (x + width - 1) % width);
+#if STATE_VEC == 8
+        return (float8)(left, center.s012, center.s3456);
+#else
+        return (float4)(left, center.s012);
+#endif
+    }
+    if (dx > 0) {
+        float right = STATE_LOAD(state, row + (x + STATE_VEC) % width);
+#if STATE_VEC == 8
+        return (float8)(center.s123, center.s4567, right);
+#else
+        return (float4)(center.s123, right);
+#endif
+    }
+    return center;
+}
+#endif
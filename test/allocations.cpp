@@ -0,0 +1,127 @@
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "pipeline.hpp"
+#include "scene.hpp"
+#include "tool.hpp"
+
+
+// Checks that the pipeline does not allocate once it is warmed up: counts the heap allocations of the whole process
+// while --frames frames are computed after --warmup frames and fails unless there are none. The profiling interval is
+// capped at --frames, so the periodic profiling log line is written at least once in that window. Options that are not
+// handled here are passed on to parse_config, e.g. to check another --queue-mode. Exits with 77 (skipped) if the OpenCL
+// backend is selected but there is no platform.
+
+
+namespace {
+
+std::atomic<std::size_t> allocations{0};
+
+}
+
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
+namespace {
+
+const int exit_skipped = 77;
+
+struct allocations_config_t {
+    std::size_t frames = 200;
+    std::size_t warmup = 50;
+};
+
+}
+
+
+int main(int argc, char** argv) {
+    auto log = spdlog::stderr_logger_mt("allocations");
+
+    try {
+        allocations_config_t test;
+        tool_options_t options = {
+            {"frames", [&](const std::string& v) { test.frames = parse_size("frames", v); }},
+            {"warmup", [&](const std::string& v) { test.warmup = parse_size("warmup", v); }}
+        };
+        std::vector<char*> rest;
+        split_tool_options("allocations", options, argc, argv, rest);
+        config_t config = parse_config(static_cast<int>(rest.size()), rest.data());
+        myassert(test.frames > 0, "frames must be positive");
+        if (config.profiling_interval > test.frames) {
+            config.profiling_interval = test.frames;
+        }
+
+        cl::Context context;
+        std::vector<cl::Device> devices;
+        if (config.backend == backend_t::opencl) {
+            std::vector<cl::Platform> platforms = tool_platforms();
+            if (platforms.empty()) {
+                log->warn() << "no OpenCL platform, skip";
+                return exit_skipped;
+            }
+            devices = Pipeline::select_devices(config, tool_devices(platforms, 0, 0));
+            context = cl::Context(devices);
+        }
+
+        scene_t scene = make_demo_scene(config.n, config.m);
+        auto hTexture = std::make_shared<TripleBuffer<texture_view_t>>();
+        auto audiobuffer = std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(config), config.nsamples);
+        std::unique_ptr<Backend> pipeline = makeBackend(config, context, devices, log, scene.state.data(), scene.rules, scene.frequencies, scene.colors, hTexture, audiobuffer);
+        std::size_t retired = 0;
+        pipeline->set_stats_callback([&](const frame_stats_t&) {
+            ++retired;
+        });
+        // stands in for the audio sink and the GUI
+        auto step = [&]() {
+            pipeline->poll();
+            while (audiobuffer->read_block()) {
+                audiobuffer->commit_read();
+            }
+            hTexture->acquire();
+        };
+
+        while (retired < test.warmup) {
+            step();
+        }
+        std::size_t start = allocations.load(std::memory_order_relaxed);
+        while (retired < test.warmup + test.frames) {
+            step();
+        }
+        std::size_t counted = allocations.load(std::memory_order_relaxed) - start;
+        pipeline->drain();
+
+        if (counted > 0) {
+            log->error() << counted << " allocations in " << test.frames << " frames after warm-up";
+            return EXIT_FAILURE;
+        }
+        log->info() << "no allocations in " << test.frames << " frames after warm-up";
+    } catch (const cl::Error& e) {
+        log->error() << e.what() << " (" << e.err() << ")";
+        return EXIT_FAILURE;
+    } catch (const std::exception& e) {
+        log->error() << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
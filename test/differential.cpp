@@ -0,0 +1,143 @@
+#include <cmath>
+#include <cstdlib>
+
+#include <algorithm>
+#include <memory>
+
+#include "backend.hpp"
+#include "common.hpp"
+#include "config.hpp"
+#include "pipeline.hpp"
+#include "scene.hpp"
+#include "tool.hpp"
+
+
+// Differential test of the CPU backend: steps it and the fp32 OpenCL pipeline with the generic automaton kernel side by
+// side for --frames frames from the demo scene. Both sum every cell in the same order, so their states have to match
+// exactly, while the audio is reduced in a different order and only has to match within --audio-tolerance of the RMS
+// of the OpenCL output. The images of every frame may differ by --pixel-tolerance per channel, as a device may round
+// the division of the visualize kernel differently and the truncation to bytes turns that into a whole step. Options that are not handled here are passed on to parse_config, e.g. --n or --m; the backend,
+// kernel, state format and layout are fixed. Exits with 77 (skipped) if there is no OpenCL platform.
+
+
+namespace {
+
+const int exit_skipped = 77;
+
+struct differential_config_t {
+    std::size_t frames = 50;
+    double audio_tolerance = 1e-4;
+    std::size_t pixel_tolerance = 1;
+};
+
+}
+
+
+int main(int argc, char** argv) {
+    auto log = spdlog::stderr_logger_mt("differential");
+
+    try {
+        differential_config_t test;
+        tool_options_t options = {
+            {"frames", [&](const std::string& v) { test.frames = parse_size("frames", v); }},
+            {"audio-tolerance", [&](const std::string& v) { test.audio_tolerance = parse_double("audio-tolerance", v); }},
+            {"pixel-tolerance", [&](const std::string& v) { test.pixel_tolerance = parse_size("pixel-tolerance", v); }}
+        };
+        std::vector<char*> rest;
+        split_tool_options("differential", options, argc, argv, rest);
+        config_t config = parse_config(static_cast<int>(rest.size()), rest.data());
+        myassert(test.frames > 0, "frames must be positive");
+        config.automaton_kernel = automaton_kernel_t::generic;
+        config.state_format = state_format_t::fp32;
+        config.state_layout = state_layout_t::interleaved;
+        config.bands = 1;
+
+        std::vector<cl::Platform> platforms = tool_platforms();
+        if (platforms.empty()) {
+            log->warn() << "no OpenCL platform, skip";
+            return exit_skipped;
+        }
+        std::vector<cl::Device> devices = Pipeline::select_devices(config, tool_devices(platforms, 0, 0));
+        cl::Context context(devices);
+
+        config_t cpu_config = config;
+        cpu_config.backend = backend_t::cpu;
+        config_t opencl_config = config;
+        opencl_config.backend = backend_t::opencl;
+        scene_t scene = make_demo_scene(config.n, config.m);
+        std::vector<shared_texture_t> textures;
+        std::vector<shared_buffer_t<float>> audiobuffers;
+        std::vector<std::unique_ptr<Backend>> backends;
+        for (const config_t& c : {opencl_config, cpu_config}) {
+            textures.push_back(std::make_shared<TripleBuffer<texture_view_t>>());
+            audiobuffers.push_back(std::make_shared<SpscRing<float>>(Pipeline::audiobuffer_blocks(c), c.nsamples));
+            backends.push_back(makeBackend(c, context, devices, log, scene.state.data(), scene.rules, scene.frequencies, scene.colors, textures.back(), audiobuffers.back()));
+        }
+
+        double audio_error = 0.;
+        double audio_energy = 0.;
+        std::size_t nsamples = 0;
+        std::size_t pixel_mismatches = 0;
+        int pixel_error = 0;
+        for (std::size_t frame = 0; frame < test.frames; ++frame) {
+            for (auto& backend : backends) {
+                backend->step();
+            }
+            // step() retires the frame, so its image is the newest one
+            myassert(textures[0]->acquire() && textures[1]->acquire(), "missing image");
+            const unsigned char* reference = textures[0]->front().data;
+            const unsigned char* cpu = textures[1]->front().data;
+            for (std::size_t i = 0; i < 4 * config.n * config.n; ++i) {
+                int diff = std::abs(static_cast<int>(cpu[i]) - static_cast<int>(reference[i]));
+                if (diff > static_cast<int>(test.pixel_tolerance)) {
+                    if (pixel_mismatches == 0) {
+                        log->error() << "first image mismatch in frame " << frame << " at pixel " << i / 4 << " channel " << i % 4 << ": cpu " << static_cast<int>(cpu[i]) << ", opencl " << static_cast<int>(reference[i]);
+                    }
+                    ++pixel_mismatches;
+                }
+                pixel_error = std::max(pixel_error, diff);
+            }
+            for (std::size_t block = 0; block < config.generations_per_launch; ++block) {
+                const float* reference = audiobuffers[0]->read_block();
+                const float* cpu = audiobuffers[1]->read_block();
+                myassert(reference && cpu, "missing audio block");
+                for (std::size_t i = 0; i < config.nsamples; ++i) {
+                    double diff = static_cast<double>(cpu[i]) - static_cast<double>(reference[i]);
+                    audio_error += diff * diff;
+                    audio_energy += static_cast<double>(reference[i]) * static_cast<double>(reference[i]);
+                }
+                nsamples += config.nsamples;
+                audiobuffers[0]->commit_read();
+                audiobuffers[1]->commit_read();
+            }
+        }
+
+        std::vector<float> reference = backends[0]->read_state();
+        std::vector<float> cpu = backends[1]->read_state();
+        myassert(reference.size() == cpu.size(), "the backends disagree on the state size");
+        std::size_t mismatches = 0;
+        for (std::size_t i = 0; i < reference.size(); ++i) {
+            if (cpu[i] != reference[i]) {
+                if (mismatches == 0) {
+                    log->error() << "first mismatch at cell " << i / config.m << " level " << i % config.m << ": cpu " << cpu[i] << ", opencl " << reference[i];
+                }
+                ++mismatches;
+            }
+        }
+        double audio_rms = std::sqrt(audio_error / static_cast<double>(nsamples));
+        double reference_rms = std::sqrt(audio_energy / static_cast<double>(nsamples));
+        log->info() << test.frames << " frames: " << mismatches << " of " << reference.size() << " state values differ, " << pixel_mismatches << " image channels beyond the tolerance (largest difference " << pixel_error << "), audio rms error " << audio_rms << " of " << reference_rms;
+
+        if (mismatches > 0 || pixel_mismatches > 0 || audio_rms > test.audio_tolerance * reference_rms) {
+            return EXIT_FAILURE;
+        }
+    } catch (const cl::Error& e) {
+        log->error() << e.what() << " (" << e.err() << ")";
+        return EXIT_FAILURE;
+    } catch (const std::exception& e) {
+        log->error() << e.what();
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -7,15 +7,42 @@ uchar4 float4_to_uchar4(float4 in) {
     );
 }
 
-__kernel void visualize(__constant float* state, __global uchar4* texture, __constant float4* colors, uint m) {
-    uint idx = get_global_id(0) + get_global_size(0) * get_global_id(1);
-    uint base = idx * m;
+// `cell_offset` is the first cell of the state that gets drawn, to skip the halo rows of a band. Every instance gets its
+// own texture, all of them are drawn with the same colors.
+__kernel void visualize(__global const state_t* state, __global uchar4* texture, __constant float4* colors, uint m, ulong cell_offset) {
+    size_t idx = get_global_id(0) + get_global_size(0) * get_global_id(1);
+    state += INSTANCE_STATE(get_global_id(2), m);
+    texture += get_global_id(2) * get_global_size(0) * get_global_size(1);
     float4 color = (0.f, 0.f, 0.f, 0.f);
     for (uint i = 0; i < m; ++i) {
-        color += state[base + i] * colors[i];
+        color += STATE_LOAD(state, STATE_IDX(cell_offset + idx, i, m)) * colors[i];
     }
     color = max(0.f, min(color / (float)m, 1.f));
     color[3] = 1.f; // overwrite alpha
     color *= 255.f;
     texture[idx] = float4_to_uchar4(color);
 }
+
+#if defined(STATE_PLANE) && defined(STATE_VEC)
+// `visualize` for STATE_VEC neighbouring pixels per work-item, the channels are accumulated as vectors over the pixels
+// so that every level is one vector load of the planar layout. Requires NDRange(n / STATE_VEC, rows).
+__kernel void visualize_planar(__global const state_t* state, __global uchar4* texture, __constant float4* colors, uint m, ulong cell_offset) {
+    size_t idx = (get_global_id(0) + get_global_size(0) * get_global_id(1)) * STATE_VEC;
+    floatv red = 0.f;
+    floatv green = 0.f;
+    floatv blue = 0.f;
+    for (uint i = 0; i < m; ++i) {
+        floatv values = STATE_VLOAD(state, STATE_IDX(cell_offset + idx, i, m));
+        red += values * colors[i].x;
+        green += values * colors[i].y;
+        blue += values * colors[i].z;
+    }
+    uchar channels[3][STATE_VEC];
+    STATE_CAT(vstore, STATE_VEC)(STATE_CAT(convert_uchar, STATE_VEC)(max(min(red / (float)m, 1.f), 0.f) * 255.f), 0, channels[0]);
+    STATE_CAT(vstore, STATE_VEC)(STATE_CAT(convert_uchar, STATE_VEC)(max(min(green / (float)m, 1.f), 0.f) * 255.f), 0, channels[1]);
+    STATE_CAT(vstore, STATE_VEC)(STATE_CAT(convert_uchar, STATE_VEC)(max(min(blue / (float)m, 1.f), 0.f) * 255.f), 0, channels[2]);
+    for (int i = 0; i < STATE_VEC; ++i) {
+        texture[idx + i] = (uchar4)(channels[0][i], channels[1][i], channels[2][i], 255);
+    }
+}
+#endif